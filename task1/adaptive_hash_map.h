@@ -0,0 +1,397 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "task1.h"
+#include "flat_hash_map.h"
+
+enum class AdaptiveEngine {
+    Inline,
+    Chained,
+    Flat
+};
+
+// One evaluation of the workload: the statistics of the window since the
+// previous one and the engine chosen. from == to means the map stayed put.
+struct AdaptiveDecision {
+    uint64_t operation;
+    size_t size;
+    AdaptiveEngine from;
+    AdaptiveEngine to;
+    double missRate;
+    double churnRate;
+    double averageProbe;
+    const char *reason;
+};
+
+// Map that samples its own workload and moves its elements between an inline
+// vector for tiny maps, HashMap chaining and FlatHashMap open addressing.
+// Workload is evaluated every DecisionInterval operations, lookups included,
+// but elements are only moved at safe points: while the map is small, when
+// its size reaches a power of two (where the engines would rehash anyway),
+// or once enough operations have passed to pay for the move. To keep a
+// workload near a threshold from bouncing the map between Chained and Flat,
+// each rule has a looser threshold for staying than for switching, and the
+// map stays on a hash engine for at least MinDwell evaluations. Long probes
+// in Flat that run over deleted markers are fixed by rebuilding the table
+// in place; other long probes keep Flat out until the size has changed by
+// a factor of two.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType> >
+class AdaptiveHashMap {
+    using MyPair = typename std::pair<const KeyType, ValueType>;
+
+  private:
+    static const size_t InlineLimit = 8;
+    static const size_t DecisionInterval = 1024;
+    static const size_t ProbeSampleRate = 8;
+    // probe lengths have a long tail; fewer samples trip the probe rules
+    // on noise
+    static const size_t MinProbeSamples = 128;
+    static const size_t MaxLogSize = 1024;
+    static const size_t MinDwell = 8;
+    static constexpr double MissEnter = 0.3;
+    static constexpr double MissExit = 0.2;
+    static constexpr double ChurnEnter = 0.5;
+    static constexpr double ChurnExit = 0.35;
+    static constexpr double ProbeExit = 4;
+
+    Hash hasher;
+    AdaptiveEngine engine = AdaptiveEngine::Inline;
+    std::vector<std::pair<KeyType, ValueType>> inlineData;
+    HashMap<KeyType, ValueType, Hash> chained;
+    FlatHashMap<KeyType, ValueType, Hash> flat;
+
+    uint64_t operations = 0;
+    uint64_t lastMigration = 0;
+    size_t dwell = 0;
+    // size at which Flat was left for long probes, 0 if it was not
+    size_t longProbeSize = 0;
+    size_t lookups = 0;
+    size_t misses = 0;
+    size_t writes = 0;
+    size_t probeSum = 0;
+    size_t probeSamples = 0;
+    std::deque<AdaptiveDecision> log;
+
+    size_t inlineIndex(const KeyType &key) const {
+        for (size_t i = 0; i < inlineData.size(); ++i) {
+            if (inlineData[i].first == key) {
+                return i;
+            }
+        }
+        return inlineData.size();
+    }
+
+    // one hit in ProbeSampleRate is sampled; misses are left out, as their
+    // probe length says more about the load factor than about clustering
+    void sampleProbe(const KeyType &key) {
+        if ((lookups - misses) % ProbeSampleRate != 0) {
+            return;
+        }
+        switch (engine) {
+          case AdaptiveEngine::Inline:
+            probeSum += inlineIndex(key) + 1;
+            break;
+          case AdaptiveEngine::Chained:
+            probeSum += chained.bucket_size(chained.bucket(key));
+            break;
+          case AdaptiveEngine::Flat:
+            probeSum += flat.probe_length(key);
+            break;
+        }
+        ++probeSamples;
+    }
+
+    ValueType* lookup(const KeyType &key) {
+        switch (engine) {
+          case AdaptiveEngine::Inline: {
+            size_t index = inlineIndex(key);
+            return index == inlineData.size() ? nullptr : &inlineData[index].second;
+          }
+          case AdaptiveEngine::Chained: {
+            auto it = chained.find(key);
+            return it == chained.end() ? nullptr : &it->second;
+          }
+          case AdaptiveEngine::Flat: {
+            auto it = flat.find(key);
+            return it == flat.end() ? nullptr : &it->second;
+          }
+        }
+        return nullptr;
+    }
+
+    const char* recommend(AdaptiveEngine &choice, double missRate, double churnRate,
+                          double averageProbe) const {
+        size_t count = size();
+        if (count <= InlineLimit / 2 || (engine == AdaptiveEngine::Inline && count < InlineLimit)) {
+            choice = AdaptiveEngine::Inline;
+            return "tiny map";
+        }
+        if (engine == AdaptiveEngine::Flat && averageProbe > ProbeExit) {
+            choice = AdaptiveEngine::Chained;
+            return "long probe sequences";
+        }
+        if (engine != AdaptiveEngine::Flat && longProbeSize != 0 &&
+            count < 2 * longProbeSize && 2 * count > longProbeSize) {
+            choice = AdaptiveEngine::Chained;
+            return "flat probed long at this size";
+        }
+        if (churnRate > (engine == AdaptiveEngine::Chained ? ChurnExit : ChurnEnter) &&
+            sizeof(MyPair) > 64) {
+            choice = AdaptiveEngine::Chained;
+            return "churn on large elements";
+        }
+        if (missRate > (engine == AdaptiveEngine::Flat ? MissExit : MissEnter)) {
+            choice = AdaptiveEngine::Flat;
+            return "miss-heavy lookups";
+        }
+        if (sizeof(MyPair) <= 64) {
+            choice = AdaptiveEngine::Flat;
+            return "small elements";
+        }
+        choice = AdaptiveEngine::Chained;
+        return "large elements";
+    }
+
+    template<class Function>
+    void forEachMutable(Function fn) {
+        switch (engine) {
+          case AdaptiveEngine::Inline:
+            for (auto &element : inlineData) {
+                fn(element.first, element.second);
+            }
+            break;
+          case AdaptiveEngine::Chained:
+            for (auto it = chained.begin(); it != chained.end(); ++it) {
+                fn(it->first, it->second);
+            }
+            break;
+          case AdaptiveEngine::Flat:
+            for (auto &element : flat) {
+                fn(element.first, element.second);
+            }
+            break;
+        }
+    }
+
+    // Copies the elements into a new engine built beside the current one,
+    // which is only dropped once the copy is complete, so an exception
+    // leaves the map unchanged.
+    void migrate(AdaptiveEngine target) {
+        std::vector<std::pair<KeyType, ValueType>> targetInline;
+        HashMap<KeyType, ValueType, Hash> targetChained(hasher);
+        FlatHashMap<KeyType, ValueType, Hash> targetFlat(hasher);
+        switch (target) {
+          case AdaptiveEngine::Inline:
+            targetInline.reserve(size());
+            forEachMutable([&](const KeyType &key, ValueType &value) {
+                targetInline.emplace_back(key, value);
+            });
+            break;
+          case AdaptiveEngine::Chained:
+            targetChained.reserve(size());
+            forEachMutable([&](const KeyType &key, ValueType &value) {
+                targetChained.insert({key, value});
+            });
+            break;
+          case AdaptiveEngine::Flat:
+            targetFlat.reserve(size());
+            forEachMutable([&](const KeyType &key, ValueType &value) {
+                targetFlat.insert({key, value});
+            });
+            break;
+        }
+
+        // the old engine's elements go away with the locals
+        inlineData.swap(targetInline);
+        chained.swap(targetChained);
+        flat.swap(targetFlat);
+        engine = target;
+        lastMigration = operations;
+        dwell = 0;
+    }
+
+    void evaluate(bool forced) {
+        bool due = lookups + writes >= DecisionInterval;
+        if (!forced && !due) {
+            return;
+        }
+        size_t count = size();
+        bool safe = forced || count <= 2 * InlineLimit || (count & (count - 1)) == 0 ||
+                    operations - lastMigration >= 4 * count;
+        if (!safe) {
+            return;
+        }
+
+        double missRate = lookups == 0 ? 0 : static_cast<double>(misses) / lookups;
+        double churnRate = lookups + writes == 0 ? 0
+                           : static_cast<double>(writes) / (lookups + writes);
+        // probe samples add up over evaluations until there are enough
+        bool probesKnown = probeSamples >= MinProbeSamples;
+        double averageProbe = !probesKnown ? 0
+                              : static_cast<double>(probeSum) / probeSamples;
+        AdaptiveEngine choice = engine;
+        const char *reason;
+        if (engine == AdaptiveEngine::Flat && averageProbe > ProbeExit &&
+            2 * flat.deleted_count() >= count) {
+            // the probes run over deleted markers, which a rebuild drops
+            flat.shrink_to_fit();
+            probesKnown = true;
+            reason = "rehashed away deleted markers";
+        } else {
+            reason = recommend(choice, missRate, churnRate, averageProbe);
+            // moves to and from the inline vector follow the size and are cheap
+            if (choice != engine && engine != AdaptiveEngine::Inline &&
+                choice != AdaptiveEngine::Inline && dwell < MinDwell) {
+                choice = engine;
+                reason = "minimum dwell";
+            }
+        }
+        if (engine == AdaptiveEngine::Flat && choice == AdaptiveEngine::Chained &&
+            averageProbe > ProbeExit) {
+            longProbeSize = count;
+        }
+        ++dwell;
+        log.push_back(AdaptiveDecision{operations, count, engine, choice,
+                                       missRate, churnRate, averageProbe, reason});
+        if (log.size() > MaxLogSize) {
+            log.pop_front();
+        }
+        if (choice != engine) {
+            migrate(choice);
+            probesKnown = true;
+        }
+        lookups = misses = writes = 0;
+        if (probesKnown) {
+            probeSum = probeSamples = 0;
+        }
+    }
+
+  public:
+    explicit AdaptiveHashMap(Hash _hasher = Hash()) :
+        hasher(_hasher), chained(_hasher), flat(_hasher) {}
+
+    Hash hash_function() const {
+        return hasher;
+    }
+
+    AdaptiveEngine current_engine() const {
+        return engine;
+    }
+
+    // most recent evaluations, oldest first
+    const std::deque<AdaptiveDecision>& decisions() const {
+        return log;
+    }
+
+    size_t size() const {
+        switch (engine) {
+          case AdaptiveEngine::Inline:
+            return inlineData.size();
+          case AdaptiveEngine::Chained:
+            return chained.size();
+          case AdaptiveEngine::Flat:
+            return flat.size();
+        }
+        return 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Returns nullptr if the key is absent. The pointer is invalidated by
+    // the next call of find(), insert() or erase(), any of which may move
+    // the elements to another engine.
+    ValueType* find(const KeyType &key) {
+        evaluate(false);
+        ++operations;
+        ++lookups;
+        ValueType *value = lookup(key);
+        if (value == nullptr) {
+            ++misses;
+        } else {
+            sampleProbe(key);
+        }
+        return value;
+    }
+
+    bool contains(const KeyType &key) {
+        return find(key) != nullptr;
+    }
+
+    const ValueType& at(const KeyType &key) {
+        ValueType *value = find(key);
+        if (value == nullptr) {
+            throw std::out_of_range("There is no such key");
+        }
+        return *value;
+    }
+
+    // An exception leaves the map unchanged: evaluation, which may move
+    // the elements, runs before the mutation.
+    void insert(const MyPair &v) {
+        evaluate(false);
+        ++operations;
+        ++writes;
+        if (lookup(v.first) != nullptr) {
+            return;
+        }
+        if (engine == AdaptiveEngine::Inline && inlineData.size() == InlineLimit) {
+            evaluate(true);
+        }
+        switch (engine) {
+          case AdaptiveEngine::Inline:
+            inlineData.emplace_back(v.first, v.second);
+            break;
+          case AdaptiveEngine::Chained:
+            chained.insert(v);
+            break;
+          case AdaptiveEngine::Flat:
+            flat.insert(v);
+            break;
+        }
+    }
+
+    void erase(const KeyType &key) {
+        evaluate(false);
+        ++operations;
+        ++writes;
+        switch (engine) {
+          case AdaptiveEngine::Inline: {
+            size_t index = inlineIndex(key);
+            if (index != inlineData.size()) {
+                inlineData[index] = std::move(inlineData.back());
+                inlineData.pop_back();
+            }
+            break;
+          }
+          case AdaptiveEngine::Chained:
+            chained.erase(key);
+            break;
+          case AdaptiveEngine::Flat:
+            flat.erase(key);
+            break;
+        }
+    }
+
+    ValueType& operator[] (const KeyType &key) {
+        ValueType *value = find(key);
+        if (value == nullptr) {
+            insert({key, ValueType()});
+            value = lookup(key);
+        }
+        return *value;
+    }
+
+    template<class Function>
+    void for_each(Function fn) {
+        forEachMutable([&](const KeyType &key, ValueType &value) {
+            fn(key, value);
+        });
+    }
+};
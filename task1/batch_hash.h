@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "cpu_dispatch.h"
+
+// Hash kernels that work on arrays of keys. Integers go through a 64-bit
+// finalizer (murmur3 fmix64) that is evaluated 4 keys per AVX2 instruction or
+// 8 keys per AVX-512 instruction when cpu_level() allows; strings use a
+// wyhash-style hash of their bytes. Every batch result equals the one of
+// BatchHash<Key>()(key), so a map may mix batch and single-key hashing.
+
+namespace batch_hash_detail {
+
+const uint64_t Multiplier1 = 0xff51afd7ed558ccdull;
+const uint64_t Multiplier2 = 0xc4ceb9fe1a85ec53ull;
+const uint64_t Secret0 = 0xa0761d6478bd642full;
+const uint64_t Secret1 = 0xe7037ed1a0b428dbull;
+
+inline uint64_t mixInteger(uint64_t x) {
+    x ^= x >> 33;
+    x *= Multiplier1;
+    x ^= x >> 33;
+    x *= Multiplier2;
+    x ^= x >> 33;
+    return x;
+}
+
+// folds the 128-bit product of a and b
+inline uint64_t multiplyFold(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 Product;
+    Product product = static_cast<Product>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t aHigh = a >> 32, aLow = static_cast<uint32_t>(a);
+    uint64_t bHigh = b >> 32, bLow = static_cast<uint32_t>(b);
+    uint64_t lowLow = aLow * bLow, highLow = aHigh * bLow;
+    uint64_t lowHigh = aLow * bHigh, highHigh = aHigh * bHigh;
+    uint64_t cross = (lowLow >> 32) + static_cast<uint32_t>(highLow) + lowHigh;
+    uint64_t high = highHigh + (highLow >> 32) + (cross >> 32);
+    uint64_t low = (cross << 32) | static_cast<uint32_t>(lowLow);
+    return low ^ high;
+#endif
+}
+
+inline uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t read32(const unsigned char *p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t hashBytes(const void *data, size_t length) {
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    uint64_t seed = Secret0 ^ multiplyFold(Secret0 ^ length, Secret1);
+    uint64_t a, b;
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t middle = (length >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + middle);
+            b = (read32(p + length - 4) << 32) | read32(p + length - 4 - middle);
+        } else if (length > 0) {
+            a = (uint64_t(p[0]) << 16) | (uint64_t(p[length >> 1]) << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t remaining = length;
+        while (remaining > 16) {
+            seed = multiplyFold(read64(p) ^ Secret1, read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        a = read64(p + remaining - 16);
+        b = read64(p + remaining - 8);
+    }
+    return multiplyFold(Secret1 ^ length, multiplyFold(a ^ Secret1, b ^ seed));
+}
+
+template<class Key>
+uint64_t toInteger(Key key) {
+    if constexpr (std::is_enum<Key>::value) {
+        return static_cast<uint64_t>(static_cast<typename std::underlying_type<Key>::type>(key));
+    } else {
+        return static_cast<uint64_t>(key);
+    }
+}
+
+#if defined(CPU_DISPATCH_X86)
+__attribute__((target("avx2")))
+inline __m256i multiply64(__m256i a, __m256i b) {
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+inline __m256i mixInteger(__m256i x) {
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+    x = multiply64(x, _mm256_set1_epi64x(static_cast<long long>(Multiplier1)));
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+    x = multiply64(x, _mm256_set1_epi64x(static_cast<long long>(Multiplier2)));
+    return _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+}
+
+// Size is the key width; 4-byte keys are widened the way a cast to
+// uint64_t would widen them.
+template<size_t Size, bool Signed>
+__attribute__((target("avx2")))
+size_t hashIntegersAvx2(const void *keys, size_t count, uint64_t *out) {
+    const char *p = static_cast<const char*>(keys);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x;
+        if constexpr (Size == 8) {
+            x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 8));
+        } else if constexpr (Signed) {
+            x = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 4)));
+        } else {
+            x = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 4)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), mixInteger(x));
+    }
+    return i;
+}
+
+template<size_t Size, bool Signed>
+__attribute__((target("avx512f,avx512dq")))
+size_t hashIntegersAvx512(const void *keys, size_t count, uint64_t *out) {
+    const char *p = static_cast<const char*>(keys);
+    const __m512i multiplier1 = _mm512_set1_epi64(static_cast<long long>(Multiplier1));
+    const __m512i multiplier2 = _mm512_set1_epi64(static_cast<long long>(Multiplier2));
+    // the zero-masked forms keep GCC from warning about the undefined
+    // merge source of the unmasked ones
+    const __mmask8 all = 0xff;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i x;
+        if constexpr (Size == 8) {
+            x = _mm512_loadu_si512(p + i * 8);
+        } else if constexpr (Signed) {
+            x = _mm512_maskz_cvtepi32_epi64(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 4)));
+        } else {
+            x = _mm512_maskz_cvtepu32_epi64(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 4)));
+        }
+        x = _mm512_xor_si512(x, _mm512_maskz_srli_epi64(all, x, 33));
+        x = _mm512_mullo_epi64(x, multiplier1);
+        x = _mm512_xor_si512(x, _mm512_maskz_srli_epi64(all, x, 33));
+        x = _mm512_mullo_epi64(x, multiplier2);
+        x = _mm512_xor_si512(x, _mm512_maskz_srli_epi64(all, x, 33));
+        _mm512_storeu_si512(out + i, x);
+    }
+    return i;
+}
+
+#endif
+
+template<class Key>
+void hashIntegers(const Key *keys, size_t count, uint64_t *out) {
+    size_t done = 0;
+#if defined(CPU_DISPATCH_X86)
+    constexpr bool Vectorizable = std::is_integral<Key>::value && (sizeof(Key) == 8 || sizeof(Key) == 4);
+    if constexpr (Vectorizable) {
+        constexpr bool Signed = std::is_signed<Key>::value;
+        switch (cpu_level()) {
+          case CpuLevel::Avx512:
+            done = hashIntegersAvx512<sizeof(Key), Signed>(keys, count, out);
+            break;
+          case CpuLevel::Avx2:
+            done = hashIntegersAvx2<sizeof(Key), Signed>(keys, count, out);
+            break;
+          default:
+            break;
+        }
+    }
+#endif
+    for (size_t i = done; i < count; ++i) {
+        out[i] = mixInteger(toInteger(keys[i]));
+    }
+}
+
+} // namespace batch_hash_detail
+
+template<class Key, class Enable = void>
+struct BatchHash;
+
+template<class Key>
+struct BatchHash<Key, typename std::enable_if<std::is_integral<Key>::value ||
+                                               std::is_enum<Key>::value>::type> {
+    size_t operator()(const Key key) const {
+        return static_cast<size_t>(batch_hash_detail::mixInteger(batch_hash_detail::toInteger(key)));
+    }
+
+    void hash_batch(const Key *keys, size_t count, uint64_t *out) const {
+        batch_hash_detail::hashIntegers(keys, count, out);
+    }
+};
+
+// Variable lengths do not map onto vector lanes, so strings are hashed one
+// at a time; the hashes of a batch are independent, which lets the core
+// overlap them.
+template<class Key>
+struct BatchHash<Key, typename std::enable_if<std::is_same<Key, std::string>::value ||
+                                               std::is_same<Key, std::string_view>::value>::type> {
+    size_t operator()(std::string_view key) const {
+        return static_cast<size_t>(batch_hash_detail::hashBytes(key.data(), key.size()));
+    }
+
+    void hash_batch(const Key *keys, size_t count, uint64_t *out) const {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = batch_hash_detail::hashBytes(keys[i].data(), keys[i].size());
+        }
+    }
+};
+
+// Detects hashers with a hash_batch(const Key*, size_t, uint64_t*) member.
+template<class Hash, class Key, class Enable = void>
+struct has_hash_batch : std::false_type {};
+
+template<class Hash, class Key>
+struct has_hash_batch<Hash, Key, decltype(std::declval<const Hash&>().hash_batch(
+    std::declval<const Key*>(), size_t(), std::declval<uint64_t*>()))> : std::true_type {};
+
+// Hashes count keys into out, with the hasher's batch kernel if it has one.
+template<class Hash, class Key>
+void hash_batch(const Hash &hasher, const Key *keys, size_t count, uint64_t *out) {
+    if constexpr (has_hash_batch<Hash, Key>::value) {
+        hasher.hash_batch(keys, count, out);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = static_cast<uint64_t>(hasher(keys[i]));
+        }
+    }
+}
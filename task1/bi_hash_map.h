@@ -0,0 +1,176 @@
+#pragma once
+
+#include <list>
+#include <stdexcept>
+#include <utility>
+
+#include "composite_hash.h"
+#include "flat_hash_map.h"
+
+// One-to-one map that can be searched from both sides. Every pair is stored
+// once, in its own list node, and two open-addressing indexes hold pointers
+// to the node's left and right key, so an insertion makes one allocation and
+// one copy of each key, and the two directions cannot drift apart.
+template<class LeftType, class RightType,
+         class LeftHash = DefaultHash<LeftType>, class RightHash = DefaultHash<RightType> >
+class BiHashMap {
+    using Entry = std::pair<const LeftType, const RightType>;
+    using Entries = std::list<Entry>;
+    using EntryIterator = typename Entries::iterator;
+
+  private:
+    // hashes and compares the key a pointer refers to, and is transparent
+    // so the index can be searched by key
+    template<class Key, class KeyHash>
+    struct IndirectHash {
+        using is_transparent = void;
+
+        KeyHash hasher;
+
+        size_t operator()(const Key *key) const {
+            return hasher(*key);
+        }
+
+        size_t operator()(const Key &key) const {
+            return hasher(key);
+        }
+
+        static bool equal(const Key *key, const Key &probe) {
+            return *key == probe;
+        }
+    };
+
+    using LeftIndex = FlatHashMap<const LeftType*, EntryIterator, IndirectHash<LeftType, LeftHash>>;
+    using RightIndex = FlatHashMap<const RightType*, EntryIterator, IndirectHash<RightType, RightHash>>;
+
+    // list nodes never move, so the indexes may point into them
+    Entries entries;
+    LeftIndex leftIndex;
+    RightIndex rightIndex;
+
+    void eraseEntry(EntryIterator it) {
+        leftIndex.erase(&it->first);
+        rightIndex.erase(&it->second);
+        entries.erase(it);
+    }
+
+  public:
+    using const_iterator = typename Entries::const_iterator;
+
+    explicit BiHashMap(LeftHash leftHasher = LeftHash(), RightHash rightHasher = RightHash()) :
+        leftIndex(IndirectHash<LeftType, LeftHash>{leftHasher}),
+        rightIndex(IndirectHash<RightType, RightHash>{rightHasher}) {}
+
+    BiHashMap(const BiHashMap &other) :
+        leftIndex(other.leftIndex.hash_function()), rightIndex(other.rightIndex.hash_function()) {
+        reserve(other.size());
+        for (const auto &entry : other.entries) {
+            insert(entry.first, entry.second);
+        }
+    }
+
+    BiHashMap(BiHashMap &&other) = default;
+
+    BiHashMap& operator=(BiHashMap other) {
+        entries.swap(other.entries);
+        leftIndex.swap(other.leftIndex);
+        rightIndex.swap(other.rightIndex);
+        return *this;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    void reserve(const size_t count) {
+        leftIndex.reserve(count);
+        rightIndex.reserve(count);
+    }
+
+    // Adds the pair unless its left or its right key is already present;
+    // returns whether it was added.
+    bool insert(const LeftType &left, const RightType &right) {
+        if (leftIndex.find(left) != leftIndex.end() || rightIndex.find(right) != rightIndex.end()) {
+            return false;
+        }
+        entries.emplace_back(left, right);
+        auto it = std::prev(entries.end());
+        leftIndex.insert({&it->first, it});
+        rightIndex.insert({&it->second, it});
+        return true;
+    }
+
+    // nullptr if the key is absent
+    const RightType* find_left(const LeftType &left) const {
+        auto it = leftIndex.find(left);
+        return it == leftIndex.end() ? nullptr : &it->second->second;
+    }
+
+    const LeftType* find_right(const RightType &right) const {
+        auto it = rightIndex.find(right);
+        return it == rightIndex.end() ? nullptr : &it->second->first;
+    }
+
+    const RightType& at_left(const LeftType &left) const {
+        const RightType *right = find_left(left);
+        if (right == nullptr) {
+            throw std::out_of_range("There is no such key");
+        }
+        return *right;
+    }
+
+    const LeftType& at_right(const RightType &right) const {
+        const LeftType *left = find_right(right);
+        if (left == nullptr) {
+            throw std::out_of_range("There is no such key");
+        }
+        return *left;
+    }
+
+    bool contains_left(const LeftType &left) const {
+        return find_left(left) != nullptr;
+    }
+
+    bool contains_right(const RightType &right) const {
+        return find_right(right) != nullptr;
+    }
+
+    // Erase the pair with the given key on one side; return whether there
+    // was one.
+    bool erase_left(const LeftType &left) {
+        auto it = leftIndex.find(left);
+        if (it == leftIndex.end()) {
+            return false;
+        }
+        eraseEntry(it->second);
+        return true;
+    }
+
+    bool erase_right(const RightType &right) {
+        auto it = rightIndex.find(right);
+        if (it == rightIndex.end()) {
+            return false;
+        }
+        eraseEntry(it->second);
+        return true;
+    }
+
+    void clear() {
+        leftIndex.clear();
+        rightIndex.clear();
+        entries.clear();
+    }
+
+    // pairs in insertion order
+    const_iterator begin() const {
+        return entries.begin();
+    }
+
+    const_iterator end() const {
+        return entries.end();
+    }
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "task1.h"
+#include "change_record.h"
+#include "serialization.h"
+
+// Bounded ring of encoded change records with consecutive sequence numbers.
+// When full the oldest records are dropped; a consumer that falls behind the
+// ring has to resync from a snapshot.
+class ChangeFeed {
+  private:
+    struct Entry {
+        uint64_t sequence;
+        std::string bytes;
+    };
+
+    std::vector<Entry> ring;
+    size_t head = 0;
+    size_t count = 0;
+    uint64_t nextSequence = 1;
+
+  public:
+    explicit ChangeFeed(size_t capacity = 1 << 16) : ring(capacity == 0 ? 1 : capacity) {}
+
+    template<class KeyType, class ValueType>
+    void publish(ChangeOp op, const KeyType &key, const ValueType *value) {
+        Entry &entry = ring[(head + count) % ring.size()];
+        entry.sequence = nextSequence;
+        entry.bytes.clear();
+        ChangeRecord<KeyType, ValueType>::append(entry.bytes, nextSequence, op, key, value);
+        ++nextSequence;
+        if (count == ring.size()) {
+            head = (head + 1) % ring.size();
+        } else {
+            ++count;
+        }
+    }
+
+    // sequence of the next record to be published
+    uint64_t next_sequence() const {
+        return nextSequence;
+    }
+
+    // oldest sequence still held, next_sequence() when the ring is empty
+    uint64_t first_sequence() const {
+        return count == 0 ? nextSequence : ring[head].sequence;
+    }
+
+    // Appends records with sequence >= from, at most maxRecords of them, to
+    // out and returns the sequence to continue from. Throws if from was
+    // already dropped.
+    uint64_t read(uint64_t from, size_t maxRecords, std::string &out) const {
+        if (from < first_sequence()) {
+            throw std::out_of_range("Change feed position was overwritten");
+        }
+        uint64_t sequence = from;
+        for (; sequence < nextSequence && maxRecords > 0; ++sequence, --maxRecords) {
+            const Entry &entry = ring[(head + (sequence - first_sequence())) % ring.size()];
+            out += entry.bytes;
+        }
+        return sequence;
+    }
+};
+
+// HashMap that publishes every mutation to a ChangeFeed.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType> >
+class ReplicatedHashMap {
+    using MyPair = typename std::pair<const KeyType, ValueType>;
+
+  private:
+    HashMap<KeyType, ValueType, Hash> map;
+    ChangeFeed feed;
+
+  public:
+    explicit ReplicatedHashMap(size_t feedCapacity = 1 << 16, Hash _hasher = Hash()) :
+        map(_hasher), feed(feedCapacity) {}
+
+    const HashMap<KeyType, ValueType, Hash>& get_map() const {
+        return map;
+    }
+
+    const ChangeFeed& get_feed() const {
+        return feed;
+    }
+
+    size_t size() const {
+        return map.size();
+    }
+
+    const ValueType& at(const KeyType &key) const {
+        return map.at(key);
+    }
+
+    void insert(const MyPair &v) {
+        if (map.find(v.first) != map.end()) {
+            return;
+        }
+        map.insert(v);
+        feed.publish(ChangeOp::Insert, v.first, &v.second);
+    }
+
+    void erase(const KeyType &key) {
+        if (map.find(key) == map.end()) {
+            return;
+        }
+        map.erase(key);
+        feed.publish<KeyType, ValueType>(ChangeOp::Erase, key, nullptr);
+    }
+
+    void assign(const KeyType &key, const ValueType &value) {
+        map[key] = value;
+        feed.publish(ChangeOp::Assign, key, &value);
+    }
+
+    // Serializes the whole map as Assign records ending at the current feed
+    // position; a replica loads it with apply() and then follows the feed
+    // from checkpoint_sequence().
+    std::string checkpoint() const {
+        std::string out;
+        uint64_t sequence = feed.next_sequence() - 1;
+        for (const auto &element : map) {
+            ChangeRecord<KeyType, ValueType>::append(out, sequence, ChangeOp::Assign,
+                                                     element.first, &element.second);
+        }
+        return out;
+    }
+
+    uint64_t checkpoint_sequence() const {
+        return feed.next_sequence();
+    }
+};
+
+// Read-only copy of a ReplicatedHashMap, fed with batches of change records
+// either directly or from a pipe, socket or file descriptor.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType> >
+class HashMapReplica {
+    using Record = ChangeRecord<KeyType, ValueType>;
+
+  private:
+    HashMap<KeyType, ValueType, Hash> map;
+    std::string partial;
+    uint64_t applied = 0;
+
+  public:
+    explicit HashMapReplica(Hash _hasher = Hash()) : map(_hasher) {}
+
+    const HashMap<KeyType, ValueType, Hash>& get_map() const {
+        return map;
+    }
+
+    // sequence of the last record applied
+    uint64_t applied_sequence() const {
+        return applied;
+    }
+
+    // Applies every complete record in bytes; an incomplete trailing record
+    // is kept until the rest of it arrives. Records older than the last
+    // applied one are skipped. A corrupted record throws after the records
+    // before it are applied; the buffered bytes are dropped, since framing
+    // is lost, and the replica has to be resynchronized from a snapshot.
+    void apply(const char *bytes, size_t size) {
+        partial.append(bytes, size);
+        const char *pos = partial.data();
+        const char *end = pos + partial.size();
+        Record record;
+        RecordStatus status;
+        while ((status = record.read(pos, end)) == RecordStatus::Complete) {
+            if (record.sequence < applied) {
+                continue;
+            }
+            switch (record.op) {
+              case ChangeOp::Insert:
+                map.insert({record.key, std::move(record.value)});
+                break;
+              case ChangeOp::Erase:
+                map.erase(record.key);
+                break;
+              case ChangeOp::Assign:
+                map[record.key] = std::move(record.value);
+                break;
+            }
+            applied = record.sequence;
+        }
+        if (status == RecordStatus::Corrupt) {
+            partial.clear();
+            throw std::runtime_error("Corrupted change record after sequence " +
+                                     std::to_string(applied));
+        }
+        partial.erase(0, static_cast<size_t>(pos - partial.data()));
+    }
+
+    void apply(const std::string &bytes) {
+        apply(bytes.data(), bytes.size());
+    }
+
+    // Drops all state, e.g. before loading a fresh checkpoint after a
+    // corrupted record.
+    void clear() {
+        map.clear();
+        partial.clear();
+        applied = 0;
+    }
+
+    // Reads whatever is available on fd and applies it. Returns false at end
+    // of stream.
+    bool apply_from(int fd) {
+        char buffer[1 << 16];
+        ssize_t got;
+        do {
+            got = ::read(fd, buffer, sizeof(buffer));
+        } while (got < 0 && errno == EINTR);
+        if (got < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            throw std::runtime_error(std::string("Replica read failed: ") + std::strerror(errno));
+        }
+        apply(buffer, static_cast<size_t>(got));
+        return got != 0;
+    }
+};
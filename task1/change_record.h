@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "serialization.h"
+
+enum class ChangeOp : uint8_t {
+    Insert = 1,
+    Erase = 2,
+    Assign = 3
+};
+
+// Result of decoding a record: Incomplete asks for more bytes, Corrupt
+// means the bytes can never form a valid record.
+enum class RecordStatus {
+    Complete,
+    Incomplete,
+    Corrupt
+};
+
+// One mutation of a map, framed as
+// [u32 payload size][u32 checksum][u64 sequence][u8 op][key][value].
+// Erase records carry no value.
+template<class KeyType, class ValueType>
+struct ChangeRecord {
+    static const size_t HeaderSize = 2 * sizeof(uint32_t);
+    // larger size fields are taken as corruption rather than waited for
+    static const uint32_t MaxPayloadSize = 1u << 28;
+
+    uint64_t sequence = 0;
+    ChangeOp op = ChangeOp::Insert;
+    KeyType key;
+    ValueType value;
+
+    // hash continues an earlier checksum, for data written in pieces
+    static uint32_t checksum(const char *data, size_t size, uint32_t hash = 2166136261u) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    static void append(std::string &out, uint64_t sequence, ChangeOp op,
+                       const KeyType &key, const ValueType *value) {
+        size_t start = out.size();
+        out.append(HeaderSize, '\0');
+        Serializer<uint64_t>::write(out, sequence);
+        Serializer<uint8_t>::write(out, static_cast<uint8_t>(op));
+        Serializer<KeyType>::write(out, key);
+        if (op != ChangeOp::Erase) {
+            Serializer<ValueType>::write(out, *value);
+        }
+        uint32_t size = static_cast<uint32_t>(out.size() - start - HeaderSize);
+        uint32_t sum = checksum(out.data() + start + HeaderSize, size);
+        std::memcpy(&out[start], &size, sizeof(size));
+        std::memcpy(&out[start + sizeof(size)], &sum, sizeof(sum));
+    }
+
+    // Decodes the record at pos and advances past it when it is Complete;
+    // otherwise pos is left untouched.
+    RecordStatus read(const char *&pos, const char *end) {
+        const char *cursor = pos;
+        uint32_t size;
+        uint32_t sum;
+        if (!Serializer<uint32_t>::read(cursor, end, size) ||
+            !Serializer<uint32_t>::read(cursor, end, sum)) {
+            return RecordStatus::Incomplete;
+        }
+        if (size > MaxPayloadSize) {
+            return RecordStatus::Corrupt;
+        }
+        if (static_cast<size_t>(end - cursor) < size) {
+            return RecordStatus::Incomplete;
+        }
+        if (checksum(cursor, size) != sum) {
+            return RecordStatus::Corrupt;
+        }
+        const char *payloadEnd = cursor + size;
+        uint8_t rawOp;
+        if (!Serializer<uint64_t>::read(cursor, payloadEnd, sequence) ||
+            !Serializer<uint8_t>::read(cursor, payloadEnd, rawOp) ||
+            !Serializer<KeyType>::read(cursor, payloadEnd, key) ||
+            rawOp < static_cast<uint8_t>(ChangeOp::Insert) ||
+            rawOp > static_cast<uint8_t>(ChangeOp::Assign)) {
+            return RecordStatus::Corrupt;
+        }
+        op = static_cast<ChangeOp>(rawOp);
+        if (op != ChangeOp::Erase &&
+            !Serializer<ValueType>::read(cursor, payloadEnd, value)) {
+            return RecordStatus::Corrupt;
+        }
+        if (cursor != payloadEnd) {
+            return RecordStatus::Corrupt;
+        }
+        pos = payloadEnd;
+        return RecordStatus::Complete;
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// The default hasher of the maps. Scalars are hashed with std::hash; pairs,
+// tuples, std::arrays and structs that list their fields are hashed
+// component by component, without building a temporary key. A struct lists
+// its fields with a member
+//   auto hash_fields() const { return std::tie(a, b, c); }
+//
+// Composite and string keys get a transparent hasher, so maps can find them
+// by any value with the same components, e.g. a pair<std::string, int> key
+// by std::make_tuple(std::string_view("name"), 42).
+
+// Mixes value into seed; the result depends on the order of the values.
+inline size_t hash_combine(size_t seed, size_t value) {
+    uint64_t x = static_cast<uint64_t>(seed) + 0x9e3779b97f4a7c15ull + value;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    return static_cast<size_t>(x);
+}
+
+namespace composite_hash_detail {
+
+// string literals arrive as char arrays
+template<class T>
+struct IsStringLike : std::integral_constant<bool,
+    std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value ||
+    std::is_same<T, const char*>::value || std::is_same<T, char*>::value ||
+    (std::is_array<T>::value && std::is_same<typename std::remove_extent<T>::type, char>::value)> {};
+
+template<class T, class Enable = void>
+struct HasFields : std::false_type {};
+
+template<class T>
+struct HasFields<T, decltype(void(std::declval<const T&>().hash_fields()))> : std::true_type {};
+
+template<class T, class Enable = void>
+struct IsTupleLike : std::false_type {};
+
+template<class T>
+struct IsTupleLike<T, decltype(void(std::tuple_size<T>::value))> : std::true_type {};
+
+template<class T>
+size_t hashValue(const T &value);
+
+template<class T, size_t... I>
+size_t hashComponents(const T &value, std::index_sequence<I...>) {
+    size_t seed = std::tuple_size<T>::value;
+    ((seed = hash_combine(seed, hashValue(std::get<I>(value)))), ...);
+    return seed;
+}
+
+template<class T>
+size_t hashValue(const T &value) {
+    if constexpr (IsStringLike<T>::value) {
+        return std::hash<std::string_view>()(std::string_view(value));
+    } else if constexpr (HasFields<T>::value) {
+        return hashValue(value.hash_fields());
+    } else if constexpr (IsTupleLike<T>::value) {
+        return hashComponents(value, std::make_index_sequence<std::tuple_size<T>::value>());
+    } else {
+        return std::hash<T>()(value);
+    }
+}
+
+template<class A, class B>
+bool equalValue(const A &a, const B &b);
+
+template<class A, class B, size_t... I>
+bool equalComponents(const A &a, const B &b, std::index_sequence<I...>) {
+    return (equalValue(std::get<I>(a), std::get<I>(b)) && ...);
+}
+
+template<class A, class B>
+bool equalValue(const A &a, const B &b) {
+    if constexpr (IsStringLike<A>::value && IsStringLike<B>::value) {
+        return std::string_view(a) == std::string_view(b);
+    } else if constexpr (std::is_same<A, B>::value) {
+        return a == b;
+    } else if constexpr (HasFields<A>::value) {
+        return equalValue(a.hash_fields(), b);
+    } else if constexpr (IsTupleLike<A>::value && IsTupleLike<B>::value) {
+        static_assert(std::tuple_size<A>::value == std::tuple_size<B>::value,
+                      "a probe must have as many components as the key");
+        return equalComponents(a, b, std::make_index_sequence<std::tuple_size<A>::value>());
+    } else {
+        return a == b;
+    }
+}
+
+} // namespace composite_hash_detail
+
+// Hashes its arguments as if they were the components of one tuple, so
+// hash_values(a, b) == DefaultHash<std::pair<A, B>>()({a, b}).
+template<class... Types>
+size_t hash_values(const Types&... values) {
+    size_t seed = sizeof...(Types);
+    ((seed = hash_combine(seed, composite_hash_detail::hashValue(values))), ...);
+    return seed;
+}
+
+template<class T, class Enable = void>
+struct DefaultHash : std::hash<T> {};
+
+template<class T>
+struct DefaultHash<T, typename std::enable_if<composite_hash_detail::IsStringLike<T>::value ||
+                                              composite_hash_detail::HasFields<T>::value ||
+                                              composite_hash_detail::IsTupleLike<T>::value>::type> {
+    using is_transparent = void;
+
+    template<class Probe>
+    size_t operator()(const Probe &probe) const {
+        return composite_hash_detail::hashValue(probe);
+    }
+
+    template<class Probe>
+    static bool equal(const T &key, const Probe &probe) {
+        return composite_hash_detail::equalValue(key, probe);
+    }
+};
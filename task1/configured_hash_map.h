@@ -0,0 +1,41 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+#include "task1.h"
+#include "flat_hash_map.h"
+#include "hash_policies.h"
+
+// Storage policies pick the map layout.
+struct ChainedStorage {
+    template<class KeyType, class ValueType, class Hash, class Policy>
+    using map = HashMap<KeyType, ValueType, Hash, Policy>;
+};
+
+struct FlatStorage {
+    template<class KeyType, class ValueType, class Hash, class Policy>
+    using map = FlatHashMap<KeyType, ValueType, Hash, Policy>;
+};
+
+// Flat slots for small trivially copyable pairs, which are cheap to move on
+// growth; nodes otherwise, which never move.
+struct AutoStorage {
+    template<class KeyType, class ValueType>
+    static constexpr bool PreferFlat =
+        std::is_trivially_copyable<KeyType>::value &&
+        std::is_trivially_copyable<ValueType>::value &&
+        sizeof(std::pair<const KeyType, ValueType>) <= 32;
+
+    template<class KeyType, class ValueType, class Hash, class Policy>
+    using map = typename std::conditional<PreferFlat<KeyType, ValueType>,
+        FlatHashMap<KeyType, ValueType, Hash, Policy>,
+        HashMap<KeyType, ValueType, Hash, Policy>>::type;
+};
+
+// One-line specialization of a map, e.g.
+//   using Counts = ConfiguredHashMap<uint64_t, uint32_t, std::hash<uint64_t>, AutoStorage,
+//                                    HashPolicy<MaskIndex, DoublingGrowth>>;
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType>,
+         class Storage = AutoStorage, class Policy = DefaultHashPolicy>
+using ConfiguredHashMap = typename Storage::template map<KeyType, ValueType, Hash, Policy>;
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_DISPATCH_X86 1
+#include <immintrin.h>
+#endif
+
+// Run-time selection of SIMD kernels. Binaries are built for the baseline
+// target; kernels for newer instruction sets are compiled with target
+// attributes and only called when cpu_level() says the CPU has them. The
+// CPU is queried once, on first use.
+enum class CpuLevel {
+    Scalar = 0,
+    Sse42 = 1,
+    Avx2 = 2,
+    Avx512 = 3
+};
+
+namespace cpu_dispatch_detail {
+
+inline CpuLevel detect() {
+#if defined(CPU_DISPATCH_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx2")) {
+        return CpuLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return CpuLevel::Avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return CpuLevel::Sse42;
+    }
+#endif
+    return CpuLevel::Scalar;
+}
+
+// -1 when no level is forced
+inline std::atomic<int>& forcedLevel() {
+    static std::atomic<int> level{-1};
+    return level;
+}
+
+} // namespace cpu_dispatch_detail
+
+inline CpuLevel detected_cpu_level() {
+    static const CpuLevel level = cpu_dispatch_detail::detect();
+    return level;
+}
+
+// the level kernels are selected for: the detected one unless capped by
+// force_cpu_level()
+inline CpuLevel cpu_level() {
+    int forced = cpu_dispatch_detail::forcedLevel().load(std::memory_order_relaxed);
+    CpuLevel detected = detected_cpu_level();
+    return forced < 0 || forced > static_cast<int>(detected) ? detected : static_cast<CpuLevel>(forced);
+}
+
+// AES-NI is not part of any level; kernels using it also need Sse42
+inline bool cpu_has_aes() {
+#if defined(CPU_DISPATCH_X86)
+    static const bool supported = __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+    return supported && cpu_level() >= CpuLevel::Sse42;
+#else
+    return false;
+#endif
+}
+
+// Test hook: caps the selected level, so every kernel can be exercised on
+// one machine. Levels above the detected one are ignored. Kernels of one
+// function give identical results, but LongKeyHash picks a different hash
+// function per level, so maps using it must be built after the change.
+inline void force_cpu_level(CpuLevel level) {
+    cpu_dispatch_detail::forcedLevel().store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+inline void reset_cpu_level() {
+    cpu_dispatch_detail::forcedLevel().store(-1, std::memory_order_relaxed);
+}
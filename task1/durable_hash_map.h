@@ -0,0 +1,546 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "task1.h"
+#include "change_record.h"
+#include "serialization.h"
+
+struct WalOptions {
+    // records are buffered and written with one write() per group
+    size_t groupCommitRecords = 256;
+    size_t groupCommitBytes = 1 << 16;
+    // fdatasync after this many groups, 0 leaves syncing to commit()
+    size_t syncEveryGroups = 1;
+    // start a checkpoint once the log grows past this size, 0 disables it
+    size_t checkpointLogBytes = 64 << 20;
+    // elements written to a running checkpoint per group commit
+    size_t checkpointStepRecords = 512;
+};
+
+// Closes the descriptor when it goes out of scope.
+class ScopedFd {
+  private:
+    int fd;
+
+  public:
+    explicit ScopedFd(int _fd) : fd(_fd) {}
+
+    ScopedFd(const ScopedFd&) = delete;
+    ScopedFd& operator=(const ScopedFd&) = delete;
+
+    ~ScopedFd() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    int get() const {
+        return fd;
+    }
+};
+
+// HashMap whose mutations are appended to a write-ahead log in directory.
+// Once the log is large enough it is moved aside and a snapshot is written
+// a few thousand elements per group commit, so no single write pays for the
+// whole map. The snapshot is fuzzy: elements may be seen before or after
+// mutations made while it is written, which is harmless since every record
+// logged after the snapshot started is replayed on top of it, and each
+// record leaves its key in a state that does not depend on the earlier one.
+// On construction the snapshot is loaded and both logs are replayed up to
+// the first torn record or gap in the sequence numbers; what follows it is
+// cut off.
+//
+// A mutation's record is queued before the mutation is applied, and a
+// group that fails to be written stays queued, so commit() can retry it.
+// A failed fdatasync leaves unknown what reached the disk, so the map
+// refuses further writes and has to be reopened.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType> >
+class DurableHashMap {
+    using MyPair = typename std::pair<const KeyType, ValueType>;
+    using Record = ChangeRecord<KeyType, ValueType>;
+
+  private:
+    static constexpr uint64_t CheckpointMagic = 0x32544e5043504d48ull;
+
+    HashMap<KeyType, ValueType, Hash> map;
+    WalOptions options;
+
+    std::string directory;
+    std::string logPath;
+    // the log moved aside by a checkpoint that has not finished yet
+    std::string previousLogPath;
+    std::string checkpointPath;
+    int logFd = -1;
+    bool hasPreviousLog = false;
+    // records after this sequence, in the previous log and the log, are
+    // what the last complete checkpoint lacks
+    uint64_t rotationSequence = 0;
+
+    // a running checkpoint: its temporary file, scan() position, base
+    // sequence and the checksum and size of what was written so far
+    int checkpointFd = -1;
+    size_t checkpointCursor = 0;
+    uint64_t checkpointBase = 0;
+    uint32_t checkpointSum = 0;
+    size_t checkpointBytes = 0;
+
+    // the fsyncs of a checkpoint run on background threads: that of the log
+    // moved aside, which later log syncs wait for to keep the logs in
+    // order, and that of the snapshot, followed by its installation
+    std::future<void> previousLogSync;
+    std::future<void> install;
+
+    std::string pending;
+    size_t pendingRecords = 0;
+    size_t unsyncedGroups = 0;
+    size_t logBytes = 0;
+    uint64_t sequence = 0;
+    bool syncFailed = false;
+
+    static void fail(const std::string &what) {
+        throw std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    static void writeAll(int fd, const char *data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail("WAL write failed");
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    static bool readFile(const std::string &path, std::string &out) {
+        ScopedFd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd.get() < 0) {
+            if (errno == ENOENT) {
+                return false;
+            }
+            fail("Cannot open " + path);
+        }
+        out.clear();
+        char buffer[1 << 16];
+        ssize_t got;
+        while ((got = ::read(fd.get(), buffer, sizeof(buffer))) != 0) {
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail("Cannot read " + path);
+            }
+            out.append(buffer, static_cast<size_t>(got));
+        }
+        return true;
+    }
+
+    void syncDirectory() {
+        ScopedFd dirFd(::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (dirFd.get() >= 0) {
+            ::fsync(dirFd.get());
+        }
+    }
+
+    void loadCheckpoint() {
+        std::string image;
+        if (!readFile(checkpointPath, image)) {
+            return;
+        }
+        const char *pos = image.data();
+        const char *end = pos + image.size();
+        uint64_t magic;
+        uint32_t sum;
+        if (image.size() < sizeof(sum) ||
+            !Serializer<uint32_t>::read(pos, end, sum) ||
+            Record::checksum(pos, static_cast<size_t>(end - pos)) != sum ||
+            !Serializer<uint64_t>::read(pos, end, magic) || magic != CheckpointMagic ||
+            !Serializer<uint64_t>::read(pos, end, sequence)) {
+            throw std::runtime_error("Corrupted checkpoint " + checkpointPath);
+        }
+        // a fuzzy snapshot may hold a key twice; the log replay fixes its value
+        while (pos != end) {
+            std::pair<KeyType, ValueType> element;
+            if (!Serializer<KeyType>::read(pos, end, element.first) ||
+                !Serializer<ValueType>::read(pos, end, element.second)) {
+                throw std::runtime_error("Corrupted checkpoint " + checkpointPath);
+            }
+            map.insert(element);
+        }
+    }
+
+    // Replays the records of path that follow sequence. A torn or corrupted
+    // record ends the log, and so does a gap: the log moved aside is synced
+    // in the background, so a crash may keep later records of the new log
+    // and lose earlier ones of the old. The replayed history stays a prefix.
+    void replayLog(const std::string &path) {
+        std::string log;
+        if (!readFile(path, log)) {
+            return;
+        }
+        const char *pos = log.data();
+        const char *end = pos + log.size();
+        const char *valid = pos;
+        std::vector<Record> records;
+        uint64_t last = sequence;
+        Record record;
+        while (record.read(pos, end) == RecordStatus::Complete) {
+            if (record.sequence > last) {
+                if (record.sequence != last + 1) {
+                    break;
+                }
+                last = record.sequence;
+                records.push_back(std::move(record));
+            }
+            valid = pos;
+        }
+        size_t validBytes = static_cast<size_t>(valid - log.data());
+        if (validBytes != log.size() && ::truncate(path.c_str(), validBytes) != 0) {
+            fail("Cannot truncate WAL tail");
+        }
+        if (path == logPath) {
+            logBytes = validBytes;
+        }
+
+        map.reserve(map.size() + records.size());
+        for (auto &replayed : records) {
+            apply(replayed);
+            sequence = replayed.sequence;
+        }
+    }
+
+    void apply(Record &record) {
+        switch (record.op) {
+          case ChangeOp::Insert:
+            map.insert({record.key, std::move(record.value)});
+            break;
+          case ChangeOp::Erase:
+            map.erase(record.key);
+            break;
+          case ChangeOp::Assign:
+            map[record.key] = std::move(record.value);
+            break;
+        }
+    }
+
+    void openLog() {
+        logFd = ::open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (logFd < 0) {
+            fail("Cannot open " + logPath);
+        }
+    }
+
+    void checkWritable() const {
+        if (syncFailed) {
+            throw std::runtime_error("WAL fdatasync failed earlier, reopen the map to recover");
+        }
+    }
+
+    // Queues the record of a mutation, then applies it; the record is
+    // dropped again if applying throws.
+    template<class Mutation>
+    void logged(ChangeOp op, const KeyType &key, const ValueType *value, Mutation mutate) {
+        checkWritable();
+        size_t mark = pending.size();
+        Record::append(pending, sequence + 1, op, key, value);
+        try {
+            mutate();
+        } catch (...) {
+            pending.resize(mark);
+            throw;
+        }
+        ++sequence;
+        if (++pendingRecords >= options.groupCommitRecords ||
+            pending.size() >= options.groupCommitBytes) {
+            writeGroup();
+        }
+    }
+
+    // A group that fails to be written is cut off the log again and stays
+    // pending for the next attempt.
+    void writeGroup() {
+        checkWritable();
+        if (pending.empty()) {
+            return;
+        }
+        try {
+            writeAll(logFd, pending.data(), pending.size());
+        } catch (const std::runtime_error &) {
+            int error = errno;
+            if (::ftruncate(logFd, static_cast<off_t>(logBytes)) != 0) {
+                syncFailed = true;
+            }
+            errno = error;
+            throw;
+        }
+        logBytes += pending.size();
+        pending.clear();
+        pendingRecords = 0;
+        if (options.syncEveryGroups != 0 && ++unsyncedGroups >= options.syncEveryGroups) {
+            sync();
+        }
+        if (checkpointFd >= 0) {
+            checkpointStep(options.checkpointStepRecords);
+        } else if (options.checkpointLogBytes != 0 && logBytes >= options.checkpointLogBytes &&
+                   !installing()) {
+            beginCheckpoint();
+        }
+    }
+
+    // Moves the log aside, unless a failed checkpoint left it there already,
+    // and starts the snapshot file.
+    void beginCheckpoint() {
+        waitInstall();
+        if (!hasPreviousLog) {
+            if (::rename(logPath.c_str(), previousLogPath.c_str()) != 0) {
+                fail("Cannot move WAL aside");
+            }
+            int previousFd = logFd;
+            openLog();
+            previousLogSync = std::async(std::launch::async, [this, previousFd]() {
+                int result = ::fdatasync(previousFd);
+                ::close(previousFd);
+                if (result != 0) {
+                    fail("WAL fdatasync failed");
+                }
+                syncDirectory();
+            });
+            hasPreviousLog = true;
+            rotationSequence = sequence;
+            logBytes = 0;
+            unsyncedGroups = 0;
+        }
+        std::string tmpPath = checkpointPath + ".tmp";
+        checkpointFd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (checkpointFd < 0) {
+            fail("Cannot open " + tmpPath);
+        }
+        checkpointBase = rotationSequence;
+        checkpointCursor = 0;
+        std::string header;
+        Serializer<uint32_t>::write(header, 0);
+        Serializer<uint64_t>::write(header, CheckpointMagic);
+        Serializer<uint64_t>::write(header, checkpointBase);
+        checkpointSum = Record::checksum(header.data() + sizeof(uint32_t),
+                                         header.size() - sizeof(uint32_t));
+        checkpointBytes = 0;
+        writeCheckpoint(header);
+    }
+
+    void writeCheckpoint(const std::string &chunk) {
+        try {
+            writeAll(checkpointFd, chunk.data(), chunk.size());
+        } catch (const std::runtime_error &) {
+            abortCheckpoint();
+            throw;
+        }
+        checkpointBytes += chunk.size();
+    }
+
+    // The previous log stays, so the next checkpoint takes over its base.
+    void abortCheckpoint() {
+        ::close(checkpointFd);
+        checkpointFd = -1;
+        ::unlink((checkpointPath + ".tmp").c_str());
+    }
+
+    void checkpointStep(const size_t records) {
+        std::string chunk;
+        checkpointCursor = map.scan(checkpointCursor, records, [&](const MyPair &element) {
+            Serializer<KeyType>::write(chunk, element.first);
+            Serializer<ValueType>::write(chunk, element.second);
+        });
+        checkpointSum = Record::checksum(chunk.data(), chunk.size(), checkpointSum);
+        writeCheckpoint(chunk);
+        if (checkpointCursor == 0) {
+            finishCheckpoint();
+        }
+    }
+
+    void finishCheckpoint() {
+        if (::pwrite(checkpointFd, &checkpointSum, sizeof(checkpointSum), 0) !=
+                static_cast<ssize_t>(sizeof(checkpointSum))) {
+            int error = errno;
+            abortCheckpoint();
+            errno = error;
+            fail("Checkpoint write failed");
+        }
+        int fd = checkpointFd;
+        checkpointFd = -1;
+        install = std::async(std::launch::async, [this, fd]() {
+            std::string tmpPath = checkpointPath + ".tmp";
+            int result = ::fsync(fd);
+            ::close(fd);
+            if (result != 0) {
+                ::unlink(tmpPath.c_str());
+                fail("Checkpoint fsync failed");
+            }
+            if (::rename(tmpPath.c_str(), checkpointPath.c_str()) != 0) {
+                fail("Cannot install checkpoint");
+            }
+            syncDirectory();
+            ::unlink(previousLogPath.c_str());
+        });
+    }
+
+    bool installing() const {
+        return install.valid() &&
+               install.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
+
+    // Rethrows a failure of the background work; a failed installation
+    // keeps the previous log, so the next checkpoint covers it.
+    void waitPreviousLogSync() {
+        if (previousLogSync.valid()) {
+            try {
+                previousLogSync.get();
+            } catch (const std::runtime_error &) {
+                syncFailed = true;
+                throw;
+            }
+        }
+    }
+
+    void waitInstall() {
+        waitPreviousLogSync();
+        if (install.valid()) {
+            install.get();
+            hasPreviousLog = false;
+        }
+    }
+
+    void sync() {
+        waitPreviousLogSync();
+        if (::fdatasync(logFd) != 0) {
+            syncFailed = true;
+            fail("WAL fdatasync failed");
+        }
+        unsyncedGroups = 0;
+    }
+
+  public:
+    explicit DurableHashMap(const std::string &_directory, WalOptions _options = WalOptions(),
+                            Hash _hasher = Hash()) :
+        map(_hasher), options(_options), directory(_directory),
+        logPath(_directory + "/wal.log"), previousLogPath(_directory + "/wal.log.previous"),
+        checkpointPath(_directory + "/checkpoint") {
+        if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            fail("Cannot create " + directory);
+        }
+        loadCheckpoint();
+        rotationSequence = sequence;
+        hasPreviousLog = ::access(previousLogPath.c_str(), F_OK) == 0;
+        replayLog(previousLogPath);
+        replayLog(logPath);
+        openLog();
+    }
+
+    DurableHashMap(const DurableHashMap&) = delete;
+    DurableHashMap& operator=(const DurableHashMap&) = delete;
+
+    ~DurableHashMap() {
+        if (logFd >= 0) {
+            try {
+                commit();
+            } catch (const std::runtime_error&) {
+            }
+            ::close(logFd);
+        }
+        if (checkpointFd >= 0) {
+            ::close(checkpointFd);
+        }
+        try {
+            waitInstall();
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    const HashMap<KeyType, ValueType, Hash>& get_map() const {
+        return map;
+    }
+
+    size_t size() const {
+        return map.size();
+    }
+
+    bool empty() const {
+        return map.empty();
+    }
+
+    const ValueType& at(const KeyType &key) const {
+        return map.at(key);
+    }
+
+    typename HashMap<KeyType, ValueType, Hash>::const_iterator find(const KeyType &key) const {
+        return map.find(key);
+    }
+
+    void insert(const MyPair &v) {
+        if (map.find(v.first) != map.end()) {
+            return;
+        }
+        logged(ChangeOp::Insert, v.first, &v.second, [&]() {
+            map.insert(v);
+        });
+    }
+
+    void erase(const KeyType &key) {
+        if (map.find(key) == map.end()) {
+            return;
+        }
+        logged(ChangeOp::Erase, key, nullptr, [&]() {
+            map.erase(key);
+        });
+    }
+
+    // Logged counterpart of map[key] = value.
+    void assign(const KeyType &key, const ValueType &value) {
+        logged(ChangeOp::Assign, key, &value, [&]() {
+            map[key] = value;
+        });
+    }
+
+    // Makes every mutation so far durable.
+    void commit() {
+        writeGroup();
+        if (unsyncedGroups != 0 || options.syncEveryGroups == 0) {
+            sync();
+        }
+    }
+
+    // whether a snapshot is being written or installed
+    bool checkpointing() const {
+        return checkpointFd >= 0 || installing();
+    }
+
+    // Takes a checkpoint now, or finishes the running one, in one go, and
+    // waits until it is installed.
+    void checkpoint() {
+        writeGroup();
+        if (checkpointFd < 0) {
+            beginCheckpoint();
+        }
+        while (checkpointFd >= 0) {
+            checkpointStep(SIZE_MAX);
+        }
+        waitInstall();
+    }
+};
+
@@ -0,0 +1,564 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "composite_hash.h"
+#include "cpu_dispatch.h"
+#include "hash_policies.h"
+#include "trivially_relocatable.h"
+
+// Open addressing counterpart of HashMap: elements are stored inline in one
+// slot array, with a control byte per slot holding either Empty, Deleted or
+// seven bits of the element's hash. Lookups probe linearly and compare keys
+// only in slots whose control byte matches.
+//
+// Control bytes are only valid in groups of GroupSize slots stamped with the
+// current generation; other groups read as empty and are reset when first
+// written to. clear() keeps the capacity and just starts a new generation,
+// which is O(1) when the elements need no destruction.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType>,
+         class Policy = DefaultHashPolicy>
+class FlatHashMap {
+    using MyPair = typename std::pair<const KeyType, ValueType>;
+    using PostMix = typename Policy::PostMix;
+    using Probing = typename Policy::Probing;
+
+    static_assert(Policy::IndexMapping::PowerOfTwo,
+                  "FlatHashMap probes within power-of-two tables");
+
+  private:
+    using Slot = typename std::aligned_storage<sizeof(MyPair), alignof(MyPair)>::type;
+
+    static constexpr uint8_t Empty = 0x80;
+    static constexpr uint8_t Deleted = 0xFE;
+    static constexpr size_t GroupShift = 4;
+    static constexpr size_t GroupSize = size_t(1) << GroupShift;
+
+    Hash hasher;
+
+    std::vector<uint8_t, typename Policy::template Allocator<uint8_t>> control;
+    std::vector<Slot, typename Policy::template Allocator<Slot>> slots;
+    std::vector<uint32_t, typename Policy::template Allocator<uint32_t>> stamps;
+    uint32_t generation = 1;
+    size_t keyCount = 0;
+    size_t deletedCount = 0;
+
+    static uint8_t hashTag(size_t mixed) {
+        return static_cast<uint8_t>((mixed >> 25) & 0x7f);
+    }
+
+    MyPair* slot(size_t index) const {
+        return reinterpret_cast<MyPair*>(const_cast<Slot*>(slots.data() + index));
+    }
+
+    size_t mask() const {
+        return control.size() - 1;
+    }
+
+    uint8_t controlAt(size_t index) const {
+        return stamps[index >> GroupShift] == generation ? control[index] : Empty;
+    }
+
+    // makes the slot's group current before a control byte in it is written
+    void claimGroup(size_t index) {
+        size_t group = index >> GroupShift;
+        if (stamps[group] != generation) {
+            size_t first = group << GroupShift;
+            std::memset(control.data() + first, Empty, std::min(GroupSize, control.size() - first));
+            stamps[group] = generation;
+        }
+    }
+
+    static size_t groupsFor(size_t capacity) {
+        return (capacity + GroupSize - 1) >> GroupShift;
+    }
+
+    template<class Probe>
+    static bool matches(const KeyType &key, const Probe &probe) {
+        if constexpr (std::is_same<Probe, KeyType>::value) {
+            return key == probe;
+        } else {
+            return Hash::equal(key, probe);
+        }
+    }
+
+    // index of the key's slot, or control.size() if it is absent; other
+    // probe types need a transparent hasher
+    template<class Probe>
+    size_t findIndex(const Probe &key) const {
+        return findIndexHashed(key, hasher(key));
+    }
+
+#if defined(CPU_DISPATCH_X86)
+    // bit i is set where group[i] == value; SSE2 is part of the baseline
+    static uint32_t matchGroup(const uint8_t *group, const uint8_t value) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(value)))));
+    }
+
+    // Linear probing a whole group of control bytes at a time: the tag is
+    // matched against every slot before the group's first empty one.
+    template<class Probe>
+    size_t findIndexGrouped(const Probe &key, const size_t mixed) const {
+        uint8_t tag = hashTag(mixed);
+        size_t i = mixed & mask();
+        for (size_t visited = 0; visited <= (control.size() >> GroupShift); ++visited) {
+            size_t group = i >> GroupShift;
+            size_t first = group << GroupShift;
+            if (stamps[group] != generation) {
+                return control.size();
+            }
+            uint32_t skipped = (uint32_t(1) << (i - first)) - 1;
+            uint32_t empties = matchGroup(control.data() + first, Empty) & ~skipped;
+            uint32_t hits = matchGroup(control.data() + first, tag) & ~skipped;
+            if (empties != 0) {
+                hits &= (empties & (0 - empties)) - 1;
+            }
+            while (hits != 0) {
+                size_t index = first + static_cast<size_t>(__builtin_ctz(hits));
+                if (matches(slot(index)->first, key)) {
+                    return index;
+                }
+                hits &= hits - 1;
+            }
+            if (empties != 0) {
+                return control.size();
+            }
+            i = (first + GroupSize) & mask();
+        }
+        return control.size();
+    }
+#endif
+
+    template<class Probe>
+    size_t findIndexHashed(const Probe &key, const size_t hash) const {
+        size_t mixed = PostMix::mix(hash);
+#if defined(CPU_DISPATCH_X86)
+        if constexpr (Probing::Linear) {
+            if (control.size() >= GroupSize && cpu_level() != CpuLevel::Scalar) {
+                return findIndexGrouped(key, mixed);
+            }
+        }
+#endif
+        uint8_t tag = hashTag(mixed);
+        for (size_t i = mixed & mask(), step = 1;; i = Probing::next(i, step++, mask())) {
+            uint8_t c = controlAt(i);
+            if (c == Empty) {
+                return control.size();
+            }
+            if (c == tag && matches(slot(i)->first, key)) {
+                return i;
+            }
+        }
+    }
+
+    // first free slot on the key's probe sequence; the key must be absent
+    size_t freeIndex(size_t mixed) const {
+        size_t i = mixed & mask();
+        for (size_t step = 1; controlAt(i) != Empty && controlAt(i) != Deleted; ++step) {
+            i = Probing::next(i, step, mask());
+        }
+        return i;
+    }
+
+    void destroyAll() {
+        if (!std::is_trivially_destructible<MyPair>::value) {
+            for (size_t i = 0; i < control.size(); ++i) {
+                if (controlAt(i) < Empty) {
+                    slot(i)->~MyPair();
+                }
+            }
+        }
+    }
+
+    static void relocate(MyPair *from, MyPair *to) {
+        if constexpr (is_trivially_relocatable<MyPair>::value) {
+            std::memcpy(static_cast<void*>(to), static_cast<const void*>(from), sizeof(MyPair));
+        } else {
+            new (to) MyPair(std::move(*from));
+            from->~MyPair();
+        }
+    }
+
+    void rehash(size_t capacity) {
+        decltype(control) oldControl(capacity, Empty);
+        decltype(slots) oldSlots(capacity);
+        decltype(stamps) oldStamps(groupsFor(capacity), generation);
+        oldControl.swap(control);
+        oldSlots.swap(slots);
+        oldStamps.swap(stamps);
+        deletedCount = 0;
+        for (size_t i = 0; i < oldControl.size(); ++i) {
+            if (oldStamps[i >> GroupShift] == generation && oldControl[i] < Empty) {
+                MyPair *element = reinterpret_cast<MyPair*>(&oldSlots[i]);
+                size_t mixed = PostMix::mix(hasher(element->first));
+                size_t target = freeIndex(mixed);
+                relocate(element, slot(target));
+                control[target] = hashTag(mixed);
+            }
+        }
+    }
+
+    static size_t capacityFor(size_t count) {
+        size_t capacity = 8;
+        while (capacity * 3 < count * 4) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    template<class Map, class Pair>
+    class Iterator {
+      private:
+        Map *map;
+        size_t index;
+
+        void skipFree() {
+            while (index < map->control.size() && map->controlAt(index) >= Empty) {
+                ++index;
+            }
+        }
+
+        friend class FlatHashMap;
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Pair;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Pair*;
+        using reference = Pair&;
+
+        Iterator() : map(nullptr), index(0) {}
+
+        Iterator(Map *_map, size_t _index) : map(_map), index(_index) {
+            skipFree();
+        }
+
+        template<class OtherMap, class OtherPair>
+        Iterator(const Iterator<OtherMap, OtherPair> &other) : map(other.map), index(other.index) {}
+
+        Iterator& operator++() {
+            ++index;
+            skipFree();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator it(*this);
+            ++(*this);
+            return it;
+        }
+
+        Pair& operator*() const {
+            return *map->slot(index);
+        }
+
+        Pair* operator->() const {
+            return map->slot(index);
+        }
+
+        bool operator==(const Iterator &it) const {
+            return index == it.index;
+        }
+
+        bool operator!=(const Iterator &it) const {
+            return index != it.index;
+        }
+
+        template<class, class> friend class Iterator;
+    };
+
+  public:
+    using iterator = Iterator<FlatHashMap, MyPair>;
+    using const_iterator = Iterator<const FlatHashMap, const MyPair>;
+
+    explicit FlatHashMap(Hash _hasher = Hash()) : hasher(_hasher) {
+        clear();
+    }
+
+    template<typename iter>
+    FlatHashMap(iter begin, iter end, Hash _hasher = Hash()) : hasher(_hasher) {
+        clear();
+        reserve(std::distance(begin, end));
+        for (auto it = begin; it != end; ++it) {
+            insert(*it);
+        }
+    }
+
+    FlatHashMap(const std::initializer_list<MyPair> &list, Hash _hasher = Hash()) :
+        FlatHashMap(list.begin(), list.end(), _hasher) {}
+
+    FlatHashMap(const FlatHashMap &other) : hasher(other.hasher) {
+        clear();
+        reserve(other.size());
+        for (const auto &it : other) {
+            insert(it);
+        }
+    }
+
+    FlatHashMap(FlatHashMap &&other) noexcept :
+        hasher(std::move(other.hasher)), control(std::move(other.control)),
+        slots(std::move(other.slots)), stamps(std::move(other.stamps)),
+        generation(other.generation), keyCount(other.keyCount),
+        deletedCount(other.deletedCount) {
+        other.clear();
+    }
+
+    FlatHashMap& operator=(const FlatHashMap &other) {
+        if (&other != this) {
+            FlatHashMap copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    FlatHashMap& operator=(FlatHashMap &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~FlatHashMap() {
+        destroyAll();
+    }
+
+    void swap(FlatHashMap &other) noexcept {
+        std::swap(hasher, other.hasher);
+        control.swap(other.control);
+        slots.swap(other.slots);
+        stamps.swap(other.stamps);
+        std::swap(generation, other.generation);
+        std::swap(keyCount, other.keyCount);
+        std::swap(deletedCount, other.deletedCount);
+    }
+
+    Hash hash_function() const {
+        return hasher;
+    }
+
+    size_t size() const {
+        return keyCount;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return control.size();
+    }
+
+    // slots holding a deleted marker, which probes pass over like elements
+    size_t deleted_count() const {
+        return deletedCount;
+    }
+
+    void reserve(size_t count) {
+        size_t capacity = capacityFor(count);
+        if (capacity > control.size()) {
+            rehash(capacity);
+        }
+    }
+
+    // Rehashes into the smallest table that fits the current elements,
+    // dropping deleted markers on the way.
+    void shrink_to_fit() {
+        size_t capacity = capacityFor(keyCount);
+        if (capacity < control.size() || deletedCount != 0) {
+            rehash(capacity);
+        }
+    }
+
+    // number of slots probed to find the key, or to learn it is absent
+    size_t probe_length(const KeyType &key) const {
+        size_t mixed = PostMix::mix(hasher(key));
+        size_t length = 1;
+        for (size_t i = mixed & mask(), step = 1; controlAt(i) != Empty;
+             i = Probing::next(i, step++, mask())) {
+            if (controlAt(i) == hashTag(mixed) && slot(i)->first == key) {
+                break;
+            }
+            ++length;
+        }
+        return length;
+    }
+
+    void insert(const MyPair &v) {
+        insertHashed(v, hasher(v.first));
+    }
+
+    // Same as insert(v) for a hash computed earlier as
+    // hash_function()(v.first); checked in debug builds.
+    void insert_hashed(const MyPair &v, const size_t hash) {
+        checkHash(v.first, hash);
+        insertHashed(v, hash);
+    }
+
+  private:
+    void insertHashed(const MyPair &v, const size_t hash) {
+        if (findIndexHashed(v.first, hash) != control.size()) {
+            return;
+        }
+        if ((keyCount + deletedCount + 1) * 4 > control.size() * 3) {
+            rehash(capacityFor(keyCount + 1) > control.size() ? control.size() * 2
+                                                               : control.size());
+        }
+        size_t mixed = PostMix::mix(hash);
+        size_t index = freeIndex(mixed);
+        new (slot(index)) MyPair(v);
+        if (controlAt(index) == Deleted) {
+            --deletedCount;
+        }
+        claimGroup(index);
+        control[index] = hashTag(mixed);
+        ++keyCount;
+    }
+
+    void eraseHashed(const KeyType &key, const size_t hash) {
+        size_t index = findIndexHashed(key, hash);
+        if (index == control.size()) {
+            return;
+        }
+        slot(index)->~MyPair();
+        // with linear probing no probe sequence runs past an empty neighbour
+        if (Probing::Linear && controlAt((index + 1) & mask()) == Empty) {
+            control[index] = Empty;
+        } else {
+            control[index] = Deleted;
+            ++deletedCount;
+        }
+        --keyCount;
+    }
+
+    // a caller-supplied hash must be the one hash_function() gives
+    template<class Probe>
+    void checkHash(const Probe &key, const size_t hash) const {
+        assert(hasher(key) == hash && "hash differs from hash_function()(key)");
+        static_cast<void>(key);
+        static_cast<void>(hash);
+    }
+
+  public:
+    void erase(const KeyType &key) {
+        eraseHashed(key, hasher(key));
+    }
+
+    void erase(const KeyType &key, const size_t hash) {
+        checkHash(key, hash);
+        eraseHashed(key, hash);
+    }
+
+    ValueType& operator[] (const KeyType &key) {
+        size_t index = findIndex(key);
+        if (index == control.size()) {
+            insert({key, ValueType()});
+            index = findIndex(key);
+        }
+        return slot(index)->second;
+    }
+
+    const ValueType& at(const KeyType &key) const {
+        size_t index = findIndex(key);
+        if (index == control.size()) {
+            throw std::out_of_range("There is no such key");
+        }
+        return slot(index)->second;
+    }
+
+    // Keeps the capacity; use shrink_to_fit() to release it.
+    void clear() {
+        if (control.empty()) {
+            control.assign(8, Empty);
+            slots.assign(8, Slot());
+            stamps.assign(groupsFor(8), generation);
+        } else {
+            destroyAll();
+            if (++generation == 0) {
+                std::fill(stamps.begin(), stamps.end(), 0);
+                generation = 1;
+            }
+        }
+        keyCount = 0;
+        deletedCount = 0;
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+
+    iterator end() {
+        return iterator(this, control.size());
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, control.size());
+    }
+
+    iterator find(const KeyType &key) {
+        return iterator(this, findIndex(key));
+    }
+
+    const_iterator find(const KeyType &key) const {
+        return const_iterator(this, findIndex(key));
+    }
+
+    // Same as find(key) for a hash computed earlier as hash_function()(key),
+    // e.g. when one key is looked up in several maps with the same hasher;
+    // checked in debug builds.
+    iterator find(const KeyType &key, const size_t hash) {
+        checkHash(key, hash);
+        return iterator(this, findIndexHashed(key, hash));
+    }
+
+    const_iterator find(const KeyType &key, const size_t hash) const {
+        checkHash(key, hash);
+        return const_iterator(this, findIndexHashed(key, hash));
+    }
+
+    // Starts loading the control byte and slot a lookup with this hash
+    // probes first.
+    void prefetch(const size_t hash) const {
+        size_t index = PostMix::mix(hash) & mask();
+        HASHMAP_PREFETCH(&control[index]);
+        HASHMAP_PREFETCH(slot(index));
+    }
+
+    // Lookup by any value a transparent hasher can hash and compare with
+    // keys, e.g. a tuple of a composite key's components.
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    iterator find(const Probe &probe) {
+        return iterator(this, findIndex(probe));
+    }
+
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    const_iterator find(const Probe &probe) const {
+        return const_iterator(this, findIndex(probe));
+    }
+
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    iterator find(const Probe &probe, const size_t hash) {
+        checkHash(probe, hash);
+        return iterator(this, findIndexHashed(probe, hash));
+    }
+
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    const_iterator find(const Probe &probe, const size_t hash) const {
+        checkHash(probe, hash);
+        return const_iterator(this, findIndexHashed(probe, hash));
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HASHMAP_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define HASHMAP_PREFETCH(address) ((void)(address))
+#endif
+
+// Compile-time knobs of HashMap and FlatHashMap. Every policy is a stateless
+// struct of static functions, so choosing one costs no space or indirection.
+//
+// The defaults are not the original hard-coded behaviour. The original
+// HashMap took hasher(key) % bucket_count(), with keys * 1.618 + 1 buckets
+// and no post-mix; HashPolicy<ModuloIndex, GoldenRatioGrowth, IdentityMix>
+// places keys the same way and differs only in when it shrinks, as it
+// compares the load factor where the original compared the length of the
+// chain an erase came from. The defaults round bucket counts up to powers of
+// two, which scan() and sample_k() need, mask instead of taking a modulo,
+// and run the hash through FibonacciMix first so that identity hashes still
+// spread over the low bits.
+
+// Index mappings turn a mixed hash into a bucket index and decide which
+// bucket counts are allowed.
+struct MaskIndex {
+    static constexpr bool PowerOfTwo = true;
+
+    static size_t bucketCount(const size_t requested) {
+        if (requested > ~(~size_t(0) >> 1)) {
+            throw std::length_error("Bucket count too large");
+        }
+        size_t result = 1;
+        while (result < requested) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    static size_t index(const size_t hash, const size_t bucketCount) {
+        return hash & (bucketCount - 1);
+    }
+};
+
+struct ModuloIndex {
+    static constexpr bool PowerOfTwo = false;
+
+    static size_t bucketCount(const size_t requested) {
+        return requested == 0 ? 1 : requested;
+    }
+
+    static size_t index(const size_t hash, const size_t bucketCount) {
+        return hash % bucketCount;
+    }
+};
+
+// Growth policies decide when a chained table is resized and how many
+// buckets it asks for; the index mapping may round the request up.
+struct GoldenRatioGrowth {
+    static constexpr double BucketsPerKey = 1.618033988; // Golden ratio
+
+    static size_t bucketsFor(const size_t keys) {
+        return static_cast<size_t>(keys * BucketsPerKey + 1);
+    }
+
+    static bool shouldGrow(const size_t keys, const size_t buckets) {
+        return keys >= buckets;
+    }
+
+    static bool shouldShrink(const size_t keys, const size_t buckets) {
+        return keys * BucketsPerKey * BucketsPerKey < buckets;
+    }
+};
+
+struct DoublingGrowth {
+    static size_t bucketsFor(const size_t keys) {
+        return keys * 2 + 1;
+    }
+
+    static bool shouldGrow(const size_t keys, const size_t buckets) {
+        return keys > buckets;
+    }
+
+    static bool shouldShrink(const size_t keys, const size_t buckets) {
+        return keys * 8 < buckets;
+    }
+};
+
+// Post-mixes are applied to the user hash before it is mapped to a bucket.
+struct IdentityMix {
+    static size_t mix(const size_t hash) {
+        return hash;
+    }
+};
+
+// Spreads the high bits of a multiplicative hash into the low bits, so that
+// masking works for identity hashes such as std::hash<int>.
+struct FibonacciMix {
+    static size_t mix(const size_t hash) {
+        uint64_t mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(mixed ^ (mixed >> 32));
+    }
+};
+
+// Probing sequences of open addressing; step counts from 1.
+struct LinearProbing {
+    static constexpr bool Linear = true;
+
+    static size_t next(const size_t index, const size_t, const size_t mask) {
+        return (index + 1) & mask;
+    }
+};
+
+// Triangular steps, which visit every slot of a power-of-two table.
+struct QuadraticProbing {
+    static constexpr bool Linear = false;
+
+    static size_t next(const size_t index, const size_t step, const size_t mask) {
+        return (index + step) & mask;
+    }
+};
+
+template<class IndexMappingPolicy = MaskIndex,
+         class GrowthPolicy = GoldenRatioGrowth,
+         class HashPostMix = FibonacciMix,
+         class ProbingPolicy = LinearProbing,
+         template<class> class AllocatorTemplate = std::allocator>
+struct HashPolicy {
+    using IndexMapping = IndexMappingPolicy;
+    using Growth = GrowthPolicy;
+    using PostMix = HashPostMix;
+    using Probing = ProbingPolicy;
+
+    template<class T>
+    using Allocator = AllocatorTemplate<T>;
+};
+
+using DefaultHashPolicy = HashPolicy<>;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// String keys hashed at compile time, for lookups of constant keys in maps
+// that use ConstexprStringHash:
+//   using namespace hashed_key_literals;
+//   constexpr HashedKey Total = "requests.total"_hashed;
+//   map.find(Total.key, Total.hash);
+// The hash is 64-bit FNV-1a; it is weak in the low bits on its own, which
+// the PostMix step of the hash policy makes up for.
+struct ConstexprStringHash {
+    using is_transparent = void;
+
+    constexpr size_t operator()(std::string_view key) const {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (char c : key) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001b3ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+
+    template<class Key, class Probe>
+    static bool equal(const Key &key, const Probe &probe) {
+        return std::string_view(key) == std::string_view(probe);
+    }
+};
+
+struct HashedKey {
+    std::string_view key;
+    size_t hash;
+
+    constexpr explicit HashedKey(std::string_view _key) :
+        key(_key), hash(ConstexprStringHash()(_key)) {}
+};
+
+namespace hashed_key_literals {
+
+constexpr HashedKey operator""_hashed(const char *data, size_t length) {
+    return HashedKey(std::string_view(data, length));
+}
+
+} // namespace hashed_key_literals
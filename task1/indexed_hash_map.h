@@ -0,0 +1,393 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "task1.h"
+
+// Secondary index descriptors of IndexedHashMap. KeyFunction is a default
+// constructible functor that returns the field a record is indexed by.
+template<class KeyFunction, class Hash = void>
+struct UniqueIndex {
+    using Function = KeyFunction;
+    using HashOverride = Hash;
+    static constexpr bool Unique = true;
+};
+
+template<class KeyFunction, class Hash = void>
+struct MultiIndex {
+    using Function = KeyFunction;
+    using HashOverride = Hash;
+    static constexpr bool Unique = false;
+};
+
+// Records stored once, in list nodes, and found through a unique primary
+// index and any number of unique or multi secondary indexes, all of them
+// HashMaps of record positions that are kept in sync on insert, erase and
+// modify:
+//   IndexedHashMap<User, UserId, UniqueIndex<UserEmail>, MultiIndex<UserCity>>
+// Secondary indexes are numbered from 0 in the order they are listed.
+template<class Record, class PrimaryKeyFunction, class... SecondaryIndexes>
+class IndexedHashMap {
+    // offsets[I] is the record's position in its group of multi index I,
+    // so that it can be removed from the group without a search
+    struct Entry {
+        Record record;
+        std::array<size_t, sizeof...(SecondaryIndexes)> offsets;
+    };
+
+    using Records = std::list<Entry>;
+    using RecordIterator = typename Records::iterator;
+
+    template<class Function>
+    using KeyOf = typename std::decay<decltype(std::declval<Function>()(std::declval<const Record&>()))>::type;
+
+    using PrimaryKey = KeyOf<PrimaryKeyFunction>;
+
+    template<class Spec, size_t Slot>
+    struct Index {
+        using Key = KeyOf<typename Spec::Function>;
+        using Hash = typename std::conditional<std::is_void<typename Spec::HashOverride>::value,
+                                               DefaultHash<Key>, typename Spec::HashOverride>::type;
+        using Positions = typename std::conditional<Spec::Unique, RecordIterator,
+                                                    std::vector<RecordIterator>>::type;
+
+        HashMap<Key, Positions, Hash> map;
+
+        static Key keyOf(const Record &record) {
+            return typename Spec::Function()(record);
+        }
+
+        static bool sameKey(const Record &a, const Record &b) {
+            return keyOf(a) == keyOf(b);
+        }
+
+        bool admits(const Key &key, const RecordIterator *self) const {
+            if constexpr (Spec::Unique) {
+                auto it = map.find(key);
+                return it == map.end() || (self != nullptr && (*it).second == *self);
+            } else {
+                return true;
+            }
+        }
+
+        void add(RecordIterator position) {
+            if constexpr (Spec::Unique) {
+                map.insert({keyOf(position->record), position});
+            } else {
+                auto &positions = map[keyOf(position->record)];
+                position->offsets[Slot] = positions.size();
+                positions.push_back(position);
+            }
+        }
+
+        // swap-remove: the last record of the group takes the freed offset
+        void remove(RecordIterator position) {
+            Key key = keyOf(position->record);
+            if constexpr (Spec::Unique) {
+                map.erase(key);
+            } else {
+                auto &positions = map.find(key)->second;
+                size_t offset = position->offsets[Slot];
+                positions[offset] = positions.back();
+                positions[offset]->offsets[Slot] = offset;
+                positions.pop_back();
+                if (positions.empty()) {
+                    map.erase(key);
+                }
+            }
+        }
+    };
+
+    template<class Indexes>
+    struct NumberedIndexes;
+
+    template<size_t... I>
+    struct NumberedIndexes<std::index_sequence<I...>> {
+        using Type = std::tuple<Index<SecondaryIndexes, I>...>;
+    };
+
+    using Sequence = std::index_sequence_for<SecondaryIndexes...>;
+    using Secondaries = typename NumberedIndexes<Sequence>::Type;
+
+  private:
+    Records records;
+    HashMap<PrimaryKey, RecordIterator> primary;
+    Secondaries secondaries;
+
+    static PrimaryKey primaryKeyOf(const Record &record) {
+        return PrimaryKeyFunction()(record);
+    }
+
+    // self is the record being replaced by modify(), which may keep its keys
+    template<size_t... I>
+    bool admits(const Record &record, const RecordIterator *self, std::index_sequence<I...>) const {
+        return (std::get<I>(secondaries).admits(std::get<I>(secondaries).keyOf(record), self) && ...);
+    }
+
+    template<size_t... I>
+    void addSecondaries(RecordIterator position, std::index_sequence<I...>) {
+        (std::get<I>(secondaries).add(position), ...);
+    }
+
+    template<size_t... I>
+    void removeSecondaries(RecordIterator position, std::index_sequence<I...>) {
+        (std::get<I>(secondaries).remove(position), ...);
+    }
+
+    // moves the record at position to modified's keys in those secondary
+    // indexes whose key differs, leaving the others alone
+    template<size_t... I>
+    void replace(RecordIterator position, Record &modified, std::index_sequence<I...>) {
+        std::array<bool, sizeof...(I)> changed = {
+            !std::get<I>(secondaries).sameKey(position->record, modified)...
+        };
+        ((changed[I] ? std::get<I>(secondaries).remove(position) : void()), ...);
+        position->record = std::move(modified);
+        ((changed[I] ? std::get<I>(secondaries).add(position) : void()), ...);
+        static_cast<void>(changed);
+    }
+
+    template<size_t... I>
+    void reserveSecondaries(const size_t count, std::index_sequence<I...>) {
+        (std::get<I>(secondaries).map.reserve(count), ...);
+    }
+
+    template<size_t... I>
+    void clearSecondaries(std::index_sequence<I...>) {
+        (std::get<I>(secondaries).map.clear(), ...);
+    }
+
+    template<size_t I, class Key>
+    const Record* firstMatch(const Key &key) const {
+        const auto &index = std::get<I>(secondaries);
+        auto it = index.map.find(key);
+        if (it == index.map.end()) {
+            return nullptr;
+        }
+        if constexpr (std::tuple_element<I, std::tuple<SecondaryIndexes...>>::type::Unique) {
+            return &(*it).second->record;
+        } else {
+            return &(*it).second.front()->record;
+        }
+    }
+
+  public:
+    class const_iterator {
+        using EntryIterator = typename Records::const_iterator;
+
+      private:
+        EntryIterator it;
+
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Record;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Record*;
+        using reference = const Record&;
+
+        const_iterator() = default;
+
+        explicit const_iterator(EntryIterator _it) : it(_it) {}
+
+        const Record& operator*() const {
+            return it->record;
+        }
+
+        const Record* operator->() const {
+            return &it->record;
+        }
+
+        const_iterator& operator++() {
+            ++it;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++it;
+            return old;
+        }
+
+        const_iterator& operator--() {
+            --it;
+            return *this;
+        }
+
+        const_iterator operator--(int) {
+            const_iterator old = *this;
+            --it;
+            return old;
+        }
+
+        bool operator==(const const_iterator &other) const {
+            return it == other.it;
+        }
+
+        bool operator!=(const const_iterator &other) const {
+            return it != other.it;
+        }
+    };
+
+    IndexedHashMap() = default;
+
+    IndexedHashMap(const IndexedHashMap &other) {
+        insert(other.begin(), other.end());
+    }
+
+    IndexedHashMap& operator=(const IndexedHashMap &other) {
+        if (&other != this) {
+            clear();
+            insert(other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    size_t size() const {
+        return records.size();
+    }
+
+    bool empty() const {
+        return records.empty();
+    }
+
+    void reserve(const size_t count) {
+        primary.reserve(count);
+        reserveSecondaries(count, Sequence());
+    }
+
+    // Adds the record unless its primary key or one of its unique secondary
+    // keys is taken; returns whether it was added.
+    bool insert(const Record &record) {
+        if (primary.find(primaryKeyOf(record)) != primary.end() ||
+            !admits(record, nullptr, Sequence())) {
+            return false;
+        }
+        records.push_back(Entry{record, {}});
+        RecordIterator position = std::prev(records.end());
+        primary.insert({primaryKeyOf(position->record), position});
+        addSecondaries(position, Sequence());
+        return true;
+    }
+
+    // Bulk load: every index is grown once for the whole range instead of
+    // being rehashed as it fills up. Returns the number of records added.
+    template<class Iterator>
+    size_t insert(Iterator first, Iterator last) {
+        reserve(size() + static_cast<size_t>(std::distance(first, last)));
+        size_t added = 0;
+        for (; first != last; ++first) {
+            added += insert(*first);
+        }
+        return added;
+    }
+
+    // nullptr if there is no record with the key
+    const Record* find(const PrimaryKey &key) const {
+        auto it = primary.find(key);
+        return it == primary.end() ? nullptr : &(*it).second->record;
+    }
+
+    const Record& at(const PrimaryKey &key) const {
+        const Record *record = find(key);
+        if (record == nullptr) {
+            throw std::out_of_range("There is no such key");
+        }
+        return *record;
+    }
+
+    // The record with the key in secondary index I, or one of them for a
+    // multi index; nullptr if there is none.
+    template<size_t I, class Key>
+    const Record* find_by(const Key &key) const {
+        return firstMatch<I>(key);
+    }
+
+    // Calls fn(record) for every record with the key in secondary index I.
+    template<size_t I, class Key, class Function>
+    void for_each_by(const Key &key, Function fn) const {
+        const auto &index = std::get<I>(secondaries);
+        auto it = index.map.find(key);
+        if (it == index.map.end()) {
+            return;
+        }
+        if constexpr (std::tuple_element<I, std::tuple<SecondaryIndexes...>>::type::Unique) {
+            fn((*it).second->record);
+        } else {
+            for (const auto &position : (*it).second) {
+                fn(position->record);
+            }
+        }
+    }
+
+    template<size_t I, class Key>
+    size_t count_by(const Key &key) const {
+        size_t count = 0;
+        for_each_by<I>(key, [&](const Record &) {
+            ++count;
+        });
+        return count;
+    }
+
+    bool erase(const PrimaryKey &key) {
+        auto it = primary.find(key);
+        if (it == primary.end()) {
+            return false;
+        }
+        RecordIterator position = it->second;
+        removeSecondaries(position, Sequence());
+        primary.erase(key);
+        records.erase(position);
+        return true;
+    }
+
+    // Applies fn(Record&) to a copy of the record and stores the result if
+    // its keys do not collide with another record, re-indexing it only under
+    // the keys that changed. Returns false, leaving the record untouched, if the
+    // key is absent or the modified record would collide.
+    template<class Function>
+    bool modify(const PrimaryKey &key, Function fn) {
+        auto it = primary.find(key);
+        if (it == primary.end()) {
+            return false;
+        }
+        RecordIterator position = it->second;
+        Record modified(position->record);
+        fn(modified);
+
+        PrimaryKey newKey = primaryKeyOf(modified);
+        bool moved = !(newKey == key);
+        if ((moved && primary.find(newKey) != primary.end()) ||
+            !admits(modified, &position, Sequence())) {
+            return false;
+        }
+        if (moved) {
+            primary.erase(key);
+            primary.insert({newKey, position});
+        }
+        replace(position, modified, Sequence());
+        return true;
+    }
+
+    void clear() {
+        primary.clear();
+        clearSecondaries(Sequence());
+        records.clear();
+    }
+
+    // records in insertion order
+    const_iterator begin() const {
+        return const_iterator(records.begin());
+    }
+
+    const_iterator end() const {
+        return const_iterator(records.end());
+    }
+};
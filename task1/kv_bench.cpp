@@ -0,0 +1,250 @@
+// Load generator for kv_server. Every connection keeps --pipeline requests
+// in flight; the latency of a request is the time from sending its batch to
+// receiving its reply.
+//
+//   g++ -O2 -std=c++17 -pthread kv_bench.cpp -o kv_bench
+//   ./kv_bench [--port N | --unix PATH] [--threads N] [--connections N]
+//              [--pipeline N] [--requests N] [--keys N] [--value-size N]
+//              [--set-ratio F]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "resp.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    int port = 6379;
+    std::string unixPath;
+    size_t threads = 1;
+    size_t connections = 4;
+    size_t pipeline = 16;
+    size_t requests = 1000000;
+    size_t keys = 100000;
+    size_t valueSize = 32;
+    double setRatio = 0.1;
+};
+
+int connectTo(const Options &options) {
+    int fd;
+    if (!options.unixPath.empty()) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, options.unixPath.c_str(), sizeof(address.sun_path) - 1);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            return -1;
+        }
+    } else {
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(options.port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            return -1;
+        }
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+struct Worker {
+    std::vector<double> latencies;
+    size_t errors = 0;
+    bool failed = false;
+};
+
+void run(const Options &options, size_t connectionCount, size_t requestCount,
+         unsigned seed, Worker &worker) {
+    std::vector<int> fds;
+    for (size_t i = 0; i < connectionCount; ++i) {
+        int fd = connectTo(options);
+        if (fd < 0) {
+            worker.failed = true;
+            return;
+        }
+        fds.push_back(fd);
+    }
+
+    std::mt19937_64 random(seed);
+    std::uniform_int_distribution<size_t> keyDistribution(0, options.keys - 1);
+    std::bernoulli_distribution isSet(options.setRatio);
+    std::string value(options.valueSize, 'v');
+    std::vector<std::string> pending(fds.size());
+    std::vector<Clock::time_point> sentAt(fds.size());
+    std::vector<size_t> inFlight(fds.size());
+    worker.latencies.reserve(requestCount);
+
+    std::string batch;
+    std::string key;
+    std::vector<std::string_view> args;
+    char buffer[1 << 16];
+    size_t issued = 0;
+    while (issued < requestCount) {
+        for (size_t c = 0; c < fds.size() && issued < requestCount; ++c) {
+            batch.clear();
+            for (inFlight[c] = 0; inFlight[c] < options.pipeline && issued < requestCount;
+                 ++inFlight[c], ++issued) {
+                key = "key:" + std::to_string(keyDistribution(random));
+                if (isSet(random)) {
+                    args = {"SET", key, value};
+                } else {
+                    args = {"GET", key};
+                }
+                appendRespCommand(batch, args);
+            }
+            sentAt[c] = Clock::now();
+            if (!sendAll(fds[c], batch)) {
+                worker.failed = true;
+                return;
+            }
+        }
+
+        for (size_t c = 0; c < fds.size(); ++c) {
+            std::string &in = pending[c];
+            while (inFlight[c] > 0) {
+                size_t offset = 0;
+                size_t consumed;
+                bool isError;
+                RespStatus status;
+                while (inFlight[c] > 0 &&
+                       (status = parseRespReply(in.data() + offset, in.data() + in.size(),
+                                                consumed, isError)) == RespStatus::Complete) {
+                    offset += consumed;
+                    --inFlight[c];
+                    worker.errors += isError;
+                    worker.latencies.push_back(
+                        std::chrono::duration<double, std::micro>(Clock::now() - sentAt[c]).count());
+                }
+                in.erase(0, offset);
+                if (inFlight[c] == 0) {
+                    break;
+                }
+                if (status == RespStatus::Error) {
+                    worker.failed = true;
+                    return;
+                }
+                ssize_t n = ::recv(fds[c], buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    worker.failed = true;
+                    return;
+                }
+                in.append(buffer, static_cast<size_t>(n));
+            }
+        }
+    }
+    for (int fd : fds) {
+        ::close(fd);
+    }
+}
+
+double percentile(const std::vector<double> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * (sorted.size() - 1));
+    return sorted[index];
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        const char *value = argv[i + 1];
+        if (option == "--port") {
+            options.port = std::atoi(value);
+        } else if (option == "--unix") {
+            options.unixPath = value;
+        } else if (option == "--threads") {
+            options.threads = std::strtoul(value, nullptr, 10);
+        } else if (option == "--connections") {
+            options.connections = std::strtoul(value, nullptr, 10);
+        } else if (option == "--pipeline") {
+            options.pipeline = std::strtoul(value, nullptr, 10);
+        } else if (option == "--requests") {
+            options.requests = std::strtoul(value, nullptr, 10);
+        } else if (option == "--keys") {
+            options.keys = std::strtoul(value, nullptr, 10);
+        } else if (option == "--value-size") {
+            options.valueSize = std::strtoul(value, nullptr, 10);
+        } else if (option == "--set-ratio") {
+            options.setRatio = std::atof(value);
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", option.c_str());
+            return 1;
+        }
+    }
+    options.threads = std::max<size_t>(options.threads, 1);
+    options.connections = std::max(options.connections, options.threads);
+    options.pipeline = std::max<size_t>(options.pipeline, 1);
+    options.keys = std::max<size_t>(options.keys, 1);
+
+    std::vector<Worker> workers(options.threads);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    for (size_t t = 0; t < options.threads; ++t) {
+        size_t connections = options.connections / options.threads +
+                             (t < options.connections % options.threads);
+        size_t requests = options.requests / options.threads +
+                          (t < options.requests % options.threads);
+        threads.emplace_back(run, std::cref(options), connections, requests,
+                             static_cast<unsigned>(t + 1), std::ref(workers[t]));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> latencies;
+    size_t errors = 0;
+    for (const auto &worker : workers) {
+        if (worker.failed) {
+            std::fprintf(stderr, "connection to server failed\n");
+            return 1;
+        }
+        latencies.insert(latencies.end(), worker.latencies.begin(), worker.latencies.end());
+        errors += worker.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf("requests     %zu (%zu errors)\n", latencies.size(), errors);
+    std::printf("throughput   %.0f req/s\n", latencies.size() / seconds);
+    std::printf("latency us   p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+                percentile(latencies, 0.5), percentile(latencies, 0.9),
+                percentile(latencies, 0.99), percentile(latencies, 0.999),
+                latencies.empty() ? 0.0 : latencies.back());
+}
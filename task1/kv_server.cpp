@@ -0,0 +1,651 @@
+// In-memory key-value server speaking a RESP subset (GET, SET, DEL, MGET,
+// MSET, PING). Thread-per-core: every thread is pinned to one core, runs its
+// own epoll loop and owns one HashMap shard outright; a key lives in shard
+// hash(key) % threads and only its owner touches it, so no shard is locked.
+// A connection stays on the thread that accepted it. That thread runs the
+// keys it owns itself and forwards the others, batched per owner, through
+// the owner's mailbox; the results come back the same way. Replies leave in
+// command order, and all replies ready after a round of events are sent with
+// a single write.
+//
+//   g++ -O2 -std=c++17 -pthread kv_server.cpp -o kv_server
+//   ./kv_server [--port N | --unix PATH] [--threads N]
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "resp.h"
+#include "task1.h"
+
+namespace {
+
+using Shard = HashMap<std::string, std::string>;
+
+// unparsed input a connection may buffer; also bounds the largest command
+const size_t MaxInputBytes = size_t(64) << 20;
+// a connection is not read from while this much output waits for the
+// client, or while this many commands wait for other threads; the values
+// those commands bring back are only known once they arrive
+const size_t OutputHighWater = size_t(16) << 20;
+const size_t MaxPendingCommands = 256;
+
+// epoll tags below the first connection id
+const uint64_t ListenTag = 0;
+const uint64_t MailboxTag = 1;
+
+enum class OpKind : uint8_t {
+    Get,
+    Set,
+    Del
+};
+
+// One key of a command, sent to the thread owning the key.
+struct Op {
+    size_t origin;
+    uint64_t connection;
+    uint64_t command;
+    uint32_t part;
+    OpKind kind;
+    std::string key;
+    std::string value;
+};
+
+// found: the key was present for Get, erased for Del
+struct OpResult {
+    uint64_t connection;
+    uint64_t command;
+    uint32_t part;
+    bool found;
+    std::string value;
+};
+
+enum class CommandKind {
+    Reply,
+    Get,
+    Mget,
+    Set,
+    Del
+};
+
+// A parsed command whose reply is not written yet, either because some of
+// its keys run on other threads or because an earlier command waits.
+struct Command {
+    CommandKind kind;
+    size_t outstanding = 0;
+    int64_t erased = 0;
+    std::string reply;
+    std::vector<std::string> values;
+    std::vector<char> found;
+};
+
+struct Connection {
+    int fd;
+    uint64_t id;
+    std::string in;
+    std::string out;
+    // commands not answered yet; front() has number firstCommand
+    std::deque<Command> commands;
+    uint64_t firstCommand = 0;
+    uint32_t events = 0;
+    bool closing = false;
+    bool peerClosed = false;
+    bool dirty = false;
+};
+
+struct Worker {
+    size_t index;
+    Shard shard;
+    int epollFd = -1;
+    int eventFd = -1;
+
+    std::mutex inboxLock;
+    std::vector<Op> inboxOps;
+    std::vector<OpResult> inboxResults;
+
+    // produced during a round of events, posted to their owners at its end
+    std::vector<std::vector<Op>> outgoingOps;
+    std::vector<std::vector<OpResult>> outgoingResults;
+
+    std::unordered_map<uint64_t, Connection> connections;
+    std::vector<uint64_t> dirty;
+    uint64_t nextId = MailboxTag + 1;
+};
+
+std::vector<std::unique_ptr<Worker>> workers;
+
+size_t ownerOf(std::string_view key) {
+    return std::hash<std::string_view>()(key) % workers.size();
+}
+
+bool equalsIgnoreCase(std::string_view a, const char *b) {
+    size_t length = std::strlen(b);
+    if (a.size() != length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        char c = a[i];
+        if (c >= 'a' && c <= 'z') {
+            c = static_cast<char>(c - 'a' + 'A');
+        }
+        if (c != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run(Shard &shard, OpKind kind, const std::string &key, std::string &value) {
+    switch (kind) {
+      case OpKind::Get: {
+        auto it = shard.find(key);
+        if (it == shard.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+      }
+      case OpKind::Set:
+        shard[key] = std::move(value);
+        return true;
+      case OpKind::Del: {
+        size_t before = shard.size();
+        shard.erase(key);
+        return shard.size() != before;
+      }
+    }
+    return false;
+}
+
+void fill(Command &command, uint32_t part, bool found, std::string &&value) {
+    switch (command.kind) {
+      case CommandKind::Get:
+      case CommandKind::Mget:
+        command.found[part] = found;
+        command.values[part] = std::move(value);
+        break;
+      case CommandKind::Del:
+        command.erased += found;
+        break;
+      default:
+        break;
+    }
+}
+
+void render(const Command &command, std::string &out) {
+    switch (command.kind) {
+      case CommandKind::Reply:
+        out += command.reply;
+        break;
+      case CommandKind::Get:
+        if (command.found[0]) {
+            appendRespBulk(out, command.values[0]);
+        } else {
+            appendRespNull(out);
+        }
+        break;
+      case CommandKind::Mget:
+        appendRespArrayHeader(out, command.values.size());
+        for (size_t i = 0; i < command.values.size(); ++i) {
+            if (command.found[i]) {
+                appendRespBulk(out, command.values[i]);
+            } else {
+                appendRespNull(out);
+            }
+        }
+        break;
+      case CommandKind::Set:
+        appendRespSimple(out, "OK");
+        break;
+      case CommandKind::Del:
+        appendRespInteger(out, command.erased);
+        break;
+    }
+}
+
+void markDirty(Worker &worker, Connection &conn) {
+    if (!conn.dirty) {
+        conn.dirty = true;
+        worker.dirty.push_back(conn.id);
+    }
+}
+
+// Writes the replies of the finished commands at the front into conn.out.
+void drain(Connection &conn) {
+    while (!conn.commands.empty() && conn.commands.front().outstanding == 0) {
+        render(conn.commands.front(), conn.out);
+        conn.commands.pop_front();
+        ++conn.firstCommand;
+    }
+}
+
+void finish(Connection &conn, Command &&command) {
+    if (conn.commands.empty() && command.outstanding == 0) {
+        render(command, conn.out);
+        ++conn.firstCommand;
+        return;
+    }
+    conn.commands.push_back(std::move(command));
+}
+
+void reply(Connection &conn, std::string text) {
+    Command command;
+    command.kind = CommandKind::Reply;
+    command.reply = std::move(text);
+    finish(conn, std::move(command));
+}
+
+// Runs the keys of one command this thread owns and queues the others.
+void dispatch(Worker &worker, Connection &conn, const std::vector<std::string_view> &args) {
+    std::string_view name = args[0];
+    Command command;
+    size_t first = 1, step = 1;
+    OpKind kind;
+    if (equalsIgnoreCase(name, "GET") && args.size() == 2) {
+        command.kind = CommandKind::Get;
+        kind = OpKind::Get;
+    } else if (equalsIgnoreCase(name, "MGET") && args.size() >= 2) {
+        command.kind = CommandKind::Mget;
+        kind = OpKind::Get;
+    } else if (equalsIgnoreCase(name, "SET") && args.size() == 3) {
+        command.kind = CommandKind::Set;
+        kind = OpKind::Set;
+        step = 2;
+    } else if (equalsIgnoreCase(name, "MSET") && args.size() >= 3 && args.size() % 2 == 1) {
+        command.kind = CommandKind::Set;
+        kind = OpKind::Set;
+        step = 2;
+    } else if (equalsIgnoreCase(name, "DEL") && args.size() >= 2) {
+        command.kind = CommandKind::Del;
+        kind = OpKind::Del;
+    } else {
+        std::string text;
+        if (equalsIgnoreCase(name, "PING")) {
+            appendRespSimple(text, "PONG");
+        } else if (equalsIgnoreCase(name, "QUIT")) {
+            appendRespSimple(text, "OK");
+            conn.closing = true;
+        } else if (equalsIgnoreCase(name, "COMMAND")) {
+            appendRespArrayHeader(text, 0);
+        } else {
+            appendRespError(text, "unknown command or wrong number of arguments");
+        }
+        reply(conn, std::move(text));
+        return;
+    }
+
+    size_t parts = (args.size() - first) / step;
+    if (kind == OpKind::Get) {
+        command.values.resize(parts);
+        command.found.resize(parts);
+    }
+    uint64_t number = conn.firstCommand + conn.commands.size();
+    for (size_t part = 0; part < parts; ++part) {
+        std::string_view key = args[first + part * step];
+        std::string_view value = step == 2 ? args[first + part * step + 1] : std::string_view();
+        size_t owner = ownerOf(key);
+        if (owner == worker.index) {
+            std::string result(value);
+            bool found = run(worker.shard, kind, std::string(key), result);
+            fill(command, static_cast<uint32_t>(part), found, std::move(result));
+        } else {
+            worker.outgoingOps[owner].push_back(Op{worker.index, conn.id, number,
+                                                   static_cast<uint32_t>(part), kind,
+                                                   std::string(key), std::string(value)});
+            ++command.outstanding;
+        }
+    }
+    finish(conn, std::move(command));
+}
+
+bool blocked(const Connection &conn) {
+    return conn.out.size() >= OutputHighWater || conn.commands.size() >= MaxPendingCommands;
+}
+
+// Dispatches the complete commands in conn.in until the connection is
+// blocked; a protocol error queues an error reply and marks the connection
+// for closing.
+void process(Worker &worker, Connection &conn) {
+    std::vector<std::string_view> args;
+    size_t offset = 0;
+    bool starved = false;
+    while (!conn.closing && !blocked(conn)) {
+        size_t consumed = 0;
+        RespStatus status = parseRespCommand(conn.in.data() + offset,
+                                             conn.in.data() + conn.in.size(), args, consumed);
+        if (status == RespStatus::Incomplete) {
+            starved = true;
+            break;
+        }
+        if (status == RespStatus::Error) {
+            std::string text;
+            appendRespError(text, "protocol error");
+            reply(conn, std::move(text));
+            conn.closing = true;
+            break;
+        }
+        dispatch(worker, conn, args);
+        offset += consumed;
+    }
+    conn.in.erase(0, offset);
+    if (starved && conn.in.size() >= MaxInputBytes) {
+        std::string text;
+        appendRespError(text, "query buffer limit exceeded");
+        reply(conn, std::move(text));
+        conn.closing = true;
+        conn.in.clear();
+    }
+}
+
+// Writes as much of conn.out as the socket takes. Returns false if the
+// connection failed.
+bool flush(Connection &conn) {
+    size_t sent = 0;
+    while (sent < conn.out.size()) {
+        ssize_t n = ::send(conn.fd, conn.out.data() + sent, conn.out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    conn.out.erase(0, sent);
+    return true;
+}
+
+void closeConnection(Worker &worker, uint64_t id) {
+    auto it = worker.connections.find(id);
+    ::epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    ::close(it->second.fd);
+    worker.connections.erase(it);
+}
+
+void receive(Worker &worker, Connection &conn) {
+    char buffer[1 << 16];
+    for (;;) {
+        ssize_t n = ::recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            conn.in.append(buffer, static_cast<size_t>(n));
+            if (conn.in.size() >= MaxInputBytes) {
+                // the rest stays in the socket until process() ran
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            conn.peerClosed = true;
+        }
+        break;
+    }
+    markDirty(worker, conn);
+}
+
+// Runs the ops other threads sent for this shard and applies the results of
+// the ops this thread sent out.
+void readMailbox(Worker &worker) {
+    uint64_t count;
+    while (::read(worker.eventFd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+    std::vector<Op> ops;
+    std::vector<OpResult> results;
+    {
+        std::lock_guard<std::mutex> guard(worker.inboxLock);
+        ops.swap(worker.inboxOps);
+        results.swap(worker.inboxResults);
+    }
+    for (Op &op : ops) {
+        bool found = run(worker.shard, op.kind, op.key, op.value);
+        worker.outgoingResults[op.origin].push_back(OpResult{op.connection, op.command, op.part,
+                                                             found, std::move(op.value)});
+    }
+    for (OpResult &result : results) {
+        auto it = worker.connections.find(result.connection);
+        if (it == worker.connections.end()) {
+            // the connection closed while the op was away
+            continue;
+        }
+        Connection &conn = it->second;
+        Command &command = conn.commands[result.command - conn.firstCommand];
+        fill(command, result.part, result.found, std::move(result.value));
+        --command.outstanding;
+        markDirty(worker, conn);
+    }
+}
+
+// Appends this round's ops and results to the owners' mailboxes, waking an
+// owner whose mailbox was empty.
+void post(Worker &worker) {
+    for (size_t i = 0; i < workers.size(); ++i) {
+        std::vector<Op> &ops = worker.outgoingOps[i];
+        std::vector<OpResult> &results = worker.outgoingResults[i];
+        if (ops.empty() && results.empty()) {
+            continue;
+        }
+        Worker &owner = *workers[i];
+        bool wake;
+        {
+            std::lock_guard<std::mutex> guard(owner.inboxLock);
+            wake = owner.inboxOps.empty() && owner.inboxResults.empty();
+            owner.inboxOps.insert(owner.inboxOps.end(), std::make_move_iterator(ops.begin()),
+                                  std::make_move_iterator(ops.end()));
+            owner.inboxResults.insert(owner.inboxResults.end(),
+                                      std::make_move_iterator(results.begin()),
+                                      std::make_move_iterator(results.end()));
+        }
+        ops.clear();
+        results.clear();
+        if (wake) {
+            uint64_t one = 1;
+            while (::write(owner.eventFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+            }
+        }
+    }
+}
+
+// Brings a connection touched this round up to date: dispatches what its
+// input allows, writes finished replies and re-arms or closes it.
+void update(Worker &worker, Connection &conn) {
+    conn.dirty = false;
+    process(worker, conn);
+    drain(conn);
+    bool done = conn.commands.empty() && (conn.closing || conn.peerClosed);
+    if (!flush(conn) || (done && conn.out.empty())) {
+        closeConnection(worker, conn.id);
+        return;
+    }
+
+    // a half-closed or closing peer only waits for the rest of its replies;
+    // a blocked one is not read from until its replies drain
+    uint32_t events = conn.peerClosed || conn.closing || blocked(conn) ? 0 : EPOLLIN | EPOLLRDHUP;
+    if (!conn.out.empty()) {
+        events |= EPOLLOUT;
+    }
+    if (events != conn.events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = conn.id;
+        ::epoll_ctl(worker.epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.events = events;
+    }
+}
+
+void acceptAll(Worker &worker, int listenFd) {
+    int client;
+    while ((client = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int one = 1;
+        ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        uint64_t id = worker.nextId++;
+        Connection &conn = worker.connections[id];
+        conn.fd = client;
+        conn.id = id;
+        conn.events = EPOLLIN | EPOLLRDHUP;
+        epoll_event event{};
+        event.events = conn.events;
+        event.data.u64 = id;
+        ::epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, client, &event);
+    }
+}
+
+void serve(Worker &worker, int listenFd) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker.index, &cpus);
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+
+    epoll_event listenEvent{};
+    listenEvent.events = EPOLLIN | EPOLLEXCLUSIVE;
+    listenEvent.data.u64 = ListenTag;
+    ::epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent);
+
+    std::vector<epoll_event> events(256);
+    std::vector<uint64_t> dirty;
+    for (;;) {
+        int ready = ::epoll_wait(worker.epollFd, events.data(), static_cast<int>(events.size()), -1);
+        for (int i = 0; i < ready; ++i) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == ListenTag) {
+                acceptAll(worker, listenFd);
+                continue;
+            }
+            if (tag == MailboxTag) {
+                readMailbox(worker);
+                continue;
+            }
+            auto it = worker.connections.find(tag);
+            if (it == worker.connections.end()) {
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(worker, tag);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                receive(worker, it->second);
+            } else {
+                markDirty(worker, it->second);
+            }
+        }
+
+        dirty.swap(worker.dirty);
+        for (uint64_t id : dirty) {
+            auto it = worker.connections.find(id);
+            if (it != worker.connections.end()) {
+                update(worker, it->second);
+            }
+        }
+        dirty.clear();
+        post(worker);
+    }
+}
+
+int listenOn(int port, const std::string &unixPath) {
+    int fd;
+    if (!unixPath.empty()) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, unixPath.c_str(), sizeof(address.sun_path) - 1);
+        ::unlink(unixPath.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            return -1;
+        }
+    } else {
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            return -1;
+        }
+    }
+    if (::listen(fd, 1024) != 0) {
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int port = 6379;
+    std::string unixPath;
+    size_t threads = std::thread::hardware_concurrency();
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--port") {
+            port = std::atoi(argv[i + 1]);
+        } else if (option == "--unix") {
+            unixPath = argv[i + 1];
+        } else if (option == "--threads") {
+            threads = static_cast<size_t>(std::atoi(argv[i + 1]));
+        } else {
+            std::fprintf(stderr, "usage: %s [--port N | --unix PATH] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    ::signal(SIGPIPE, SIG_IGN);
+    int listenFd = listenOn(port, unixPath);
+    if (listenFd < 0) {
+        std::perror("listen");
+        return 1;
+    }
+
+    // every mailbox exists before any thread may post to it
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(new Worker());
+        Worker &worker = *workers.back();
+        worker.index = i;
+        worker.epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        worker.eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        worker.outgoingOps.resize(threads);
+        worker.outgoingResults.resize(threads);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = MailboxTag;
+        ::epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, worker.eventFd, &event);
+    }
+    std::vector<std::thread> loops;
+    for (size_t i = 1; i < threads; ++i) {
+        loops.emplace_back(serve, std::ref(*workers[i]), listenFd);
+    }
+    serve(*workers[0], listenFd);
+}
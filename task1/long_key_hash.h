@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "batch_hash.h"
+
+// Hashers for long string keys such as URLs and document ids, to be used as
+// the Hash argument of HashMap and FlatHashMap:
+//   Crc32cHash - three interleaved SSE4.2 CRC32C streams, 24 bytes per step
+//   AesHash    - four AES-NI lanes, 64 bytes per step
+//   LongKeyHash - the fastest of the two cpu_level() allows
+// Keys of up to ShortKeyLength bytes, and every key on CPUs without the
+// instructions, go through the portable wyhash-style hash of batch_hash.h.
+// Hash values depend on the CPU, so they must not be persisted or shared
+// between machines.
+
+namespace long_key_hash_detail {
+
+const size_t ShortKeyLength = 32;
+
+inline uint64_t hashShort(const char *data, size_t length) {
+    return batch_hash_detail::hashBytes(data, length);
+}
+
+#if defined(CPU_DISPATCH_X86)
+inline bool hasCrc32c() {
+    return cpu_level() >= CpuLevel::Sse42;
+}
+
+// length > ShortKeyLength
+__attribute__((target("sse4.2")))
+inline uint64_t hashCrc32c(const char *data, size_t length) {
+    uint64_t crc0 = 0x243f6a88, crc1 = 0x85a308d3, crc2 = 0x13198a2e;
+    const char *p = data;
+    const char *end = data + length;
+    uint64_t word0, word1, word2;
+    while (end - p > 24) {
+        std::memcpy(&word0, p, 8);
+        std::memcpy(&word1, p + 8, 8);
+        std::memcpy(&word2, p + 16, 8);
+        crc0 = _mm_crc32_u64(crc0, word0);
+        crc1 = _mm_crc32_u64(crc1, word1);
+        crc2 = _mm_crc32_u64(crc2, word2);
+        p += 24;
+    }
+    // the last 24 bytes, overlapping what was already consumed
+    std::memcpy(&word0, end - 24, 8);
+    std::memcpy(&word1, end - 16, 8);
+    std::memcpy(&word2, end - 8, 8);
+    crc0 = _mm_crc32_u64(crc0, word0);
+    crc1 = _mm_crc32_u64(crc1, word1);
+    crc2 = _mm_crc32_u64(crc2, word2);
+    // CRCs are linear, so the streams are mixed non-linearly at the end
+    return batch_hash_detail::multiplyFold((crc0 << 32 | crc1) ^ batch_hash_detail::Secret0,
+                                           (crc2 << 32 | length) ^ batch_hash_detail::Secret1);
+}
+
+// length > ShortKeyLength
+__attribute__((target("aes,sse4.1")))
+inline uint64_t hashAes(const char *data, size_t length) {
+    const __m128i key0 = _mm_set_epi64x(0x243f6a8885a308d3ll, 0x13198a2e03707344ll);
+    const __m128i key1 = _mm_set_epi64x(0x452821e638d01377ll, static_cast<long long>(length));
+    __m128i state0 = key0;
+    __m128i state1 = key1;
+    __m128i state2 = _mm_xor_si128(key0, key1);
+    __m128i state3 = _mm_set_epi64x(static_cast<long long>(length), 0x082efa98ec4e6c89ll);
+    const char *p = data;
+    const char *end = data + length;
+    auto load = [](const char *at) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+    };
+    while (end - p > 64) {
+        state0 = _mm_aesenc_si128(state0, load(p));
+        state1 = _mm_aesenc_si128(state1, load(p + 16));
+        state2 = _mm_aesenc_si128(state2, load(p + 32));
+        state3 = _mm_aesenc_si128(state3, load(p + 48));
+        p += 64;
+    }
+    // the last 64 bytes, or all of them for keys shorter than that
+    const char *tail = length >= 64 ? end - 64 : data;
+    state0 = _mm_aesenc_si128(state0, load(tail));
+    state1 = _mm_aesenc_si128(state1, load(tail + 16));
+    state2 = _mm_aesenc_si128(state2, load(end - 32));
+    state3 = _mm_aesenc_si128(state3, load(end - 16));
+
+    state0 = _mm_aesenc_si128(state0, state1);
+    state2 = _mm_aesenc_si128(state2, state3);
+    state0 = _mm_aesenc_si128(state0, state2);
+    state0 = _mm_aesenc_si128(state0, key0);
+    state0 = _mm_aesenc_si128(state0, key1);
+    return static_cast<uint64_t>(_mm_extract_epi64(state0, 0)) ^
+           static_cast<uint64_t>(_mm_extract_epi64(state0, 1));
+}
+#endif
+
+} // namespace long_key_hash_detail
+
+struct Crc32cHash {
+    size_t operator()(std::string_view key) const {
+#if defined(CPU_DISPATCH_X86)
+        if (key.size() > long_key_hash_detail::ShortKeyLength && long_key_hash_detail::hasCrc32c()) {
+            return static_cast<size_t>(long_key_hash_detail::hashCrc32c(key.data(), key.size()));
+        }
+#endif
+        return static_cast<size_t>(long_key_hash_detail::hashShort(key.data(), key.size()));
+    }
+};
+
+struct AesHash {
+    size_t operator()(std::string_view key) const {
+#if defined(CPU_DISPATCH_X86)
+        if (key.size() > long_key_hash_detail::ShortKeyLength && cpu_has_aes()) {
+            return static_cast<size_t>(long_key_hash_detail::hashAes(key.data(), key.size()));
+        }
+#endif
+        return static_cast<size_t>(long_key_hash_detail::hashShort(key.data(), key.size()));
+    }
+};
+
+struct LongKeyHash {
+    size_t operator()(std::string_view key) const {
+#if defined(CPU_DISPATCH_X86)
+        if (key.size() > long_key_hash_detail::ShortKeyLength) {
+            if (cpu_has_aes()) {
+                return static_cast<size_t>(long_key_hash_detail::hashAes(key.data(), key.size()));
+            }
+            if (long_key_hash_detail::hasCrc32c()) {
+                return static_cast<size_t>(long_key_hash_detail::hashCrc32c(key.data(), key.size()));
+            }
+        }
+#endif
+        return static_cast<size_t>(long_key_hash_detail::hashShort(key.data(), key.size()));
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A small LZ77-style byte codec. Every sequence is a token byte (high nibble:
+// literal count, low nibble: match length - MinMatch), optional length
+// extension bytes, the literals, and a 16-bit little-endian match offset.
+// The last sequence of a stream carries literals only.
+class LzCodec {
+  private:
+    static const size_t MinMatch = 4;
+    static const size_t MaxOffset = 65535;
+    static const size_t HashBits = 12;
+
+    static uint32_t load32(const char *p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static size_t hashOf(const char *p) {
+        return (load32(p) * 2654435761u) >> (32 - HashBits);
+    }
+
+    static void writeLength(std::string &out, size_t length) {
+        while (length >= 255) {
+            out.push_back(static_cast<char>(255));
+            length -= 255;
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    static bool readLength(const unsigned char *&pos, const unsigned char *end, size_t &length) {
+        unsigned char byte;
+        do {
+            if (pos == end) {
+                return false;
+            }
+            byte = *pos++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    static void emitSequence(std::string &out, const char *literals, size_t literalCount,
+                             size_t matchLength, size_t offset) {
+        size_t matchCode = matchLength == 0 ? 0 : matchLength - MinMatch;
+        unsigned char token = static_cast<unsigned char>(
+            ((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+        out.push_back(static_cast<char>(token));
+        if (literalCount >= 15) {
+            writeLength(out, literalCount - 15);
+        }
+        out.append(literals, literalCount);
+        if (matchLength == 0) {
+            return;
+        }
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (matchCode >= 15) {
+            writeLength(out, matchCode - 15);
+        }
+    }
+
+  public:
+    static std::string compress(const std::string &input) {
+        std::string out;
+        out.reserve(input.size() / 2 + 16);
+        std::vector<uint32_t> table(size_t(1) << HashBits, UINT32_MAX);
+
+        const char *base = input.data();
+        size_t size = input.size();
+        size_t anchor = 0;
+        size_t pos = 0;
+        while (pos + MinMatch <= size) {
+            size_t slot = hashOf(base + pos);
+            uint32_t candidate = table[slot];
+            table[slot] = static_cast<uint32_t>(pos);
+            if (candidate == UINT32_MAX || pos - candidate > MaxOffset ||
+                load32(base + candidate) != load32(base + pos)) {
+                ++pos;
+                continue;
+            }
+
+            size_t length = MinMatch;
+            while (pos + length < size && base[candidate + length] == base[pos + length]) {
+                ++length;
+            }
+            emitSequence(out, base + anchor, pos - anchor, length, pos - candidate);
+            pos += length;
+            anchor = pos;
+        }
+        emitSequence(out, base + anchor, size - anchor, 0, 0);
+        return out;
+    }
+
+    // Returns false if the stream is malformed or does not expand to rawSize
+    // bytes. A sequence that would write past rawSize is rejected before it
+    // is copied, so a corrupt length cannot make out grow without bound.
+    static bool decompress(const std::string &input, size_t rawSize, std::string &out) {
+        out.clear();
+        out.reserve(rawSize);
+        auto pos = reinterpret_cast<const unsigned char*>(input.data());
+        auto end = pos + input.size();
+        while (pos != end) {
+            unsigned char token = *pos++;
+            size_t literalCount = token >> 4;
+            if (literalCount == 15 && !readLength(pos, end, literalCount)) {
+                return false;
+            }
+            if (static_cast<size_t>(end - pos) < literalCount ||
+                literalCount > rawSize - out.size()) {
+                return false;
+            }
+            out.append(reinterpret_cast<const char*>(pos), literalCount);
+            pos += literalCount;
+            if (pos == end) {
+                break;
+            }
+
+            if (end - pos < 2) {
+                return false;
+            }
+            size_t offset = pos[0] | (static_cast<size_t>(pos[1]) << 8);
+            pos += 2;
+            size_t matchLength = token & 0x0f;
+            if (matchLength == 15 && !readLength(pos, end, matchLength)) {
+                return false;
+            }
+            matchLength += MinMatch;
+            if (offset == 0 || offset > out.size() || matchLength > rawSize - out.size()) {
+                return false;
+            }
+            // byte by byte: the match may overlap the bytes it produces
+            size_t from = out.size() - offset;
+            for (size_t i = 0; i < matchLength; ++i) {
+                out.push_back(out[from + i]);
+            }
+        }
+        return out.size() == rawSize;
+    }
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The subset of the Redis serialization protocol spoken by kv_server and
+// kv_bench: commands are arrays of bulk strings, replies are simple strings,
+// errors, integers, bulk strings or arrays of bulk strings.
+enum class RespStatus {
+    Complete,
+    Incomplete,
+    Error
+};
+
+namespace resp_detail {
+
+// the limits Redis applies by default
+const int64_t MaxBulkLength = int64_t(512) << 20;
+const int64_t MaxArrayLength = 1024 * 1024;
+
+// Parses "<prefix><integer>\r\n" at pos.
+inline RespStatus parseLine(const char *&pos, const char *end, char prefix, int64_t &value) {
+    if (pos == end) {
+        return RespStatus::Incomplete;
+    }
+    if (*pos != prefix) {
+        return RespStatus::Error;
+    }
+    const char *eol = static_cast<const char*>(std::memchr(pos, '\r', end - pos));
+    if (eol == nullptr || eol + 1 == end) {
+        return end - pos > 32 ? RespStatus::Error : RespStatus::Incomplete;
+    }
+    if (eol[1] != '\n') {
+        return RespStatus::Error;
+    }
+    const char *digit = pos + 1;
+    bool negative = digit != eol && *digit == '-';
+    if (negative) {
+        ++digit;
+    }
+    if (digit == eol) {
+        return RespStatus::Error;
+    }
+    if (eol - digit > 19) {
+        return RespStatus::Error;
+    }
+    value = 0;
+    for (; digit != eol; ++digit) {
+        if (*digit < '0' || *digit > '9') {
+            return RespStatus::Error;
+        }
+        if (value > (INT64_MAX - (*digit - '0')) / 10) {
+            return RespStatus::Error;
+        }
+        value = value * 10 + (*digit - '0');
+    }
+    if (negative) {
+        value = -value;
+    }
+    pos = eol + 2;
+    return RespStatus::Complete;
+}
+
+inline RespStatus parseBulk(const char *&pos, const char *end, std::string_view *bulk) {
+    int64_t length;
+    RespStatus status = parseLine(pos, end, '$', length);
+    if (status != RespStatus::Complete) {
+        return status;
+    }
+    if (length < -1 || length > MaxBulkLength) {
+        return RespStatus::Error;
+    }
+    if (length < 0) {
+        if (bulk != nullptr) {
+            *bulk = std::string_view();
+        }
+        return RespStatus::Complete;
+    }
+    if (end - pos < length + 2) {
+        return RespStatus::Incomplete;
+    }
+    if (pos[length] != '\r' || pos[length + 1] != '\n') {
+        return RespStatus::Error;
+    }
+    if (bulk != nullptr) {
+        *bulk = std::string_view(pos, static_cast<size_t>(length));
+    }
+    pos += length + 2;
+    return RespStatus::Complete;
+}
+
+} // namespace resp_detail
+
+// Parses one command from [begin, end). On Complete, args point into the
+// input and consumed is the number of bytes the command took.
+inline RespStatus parseRespCommand(const char *begin, const char *end,
+                                   std::vector<std::string_view> &args, size_t &consumed) {
+    const char *pos = begin;
+    int64_t count;
+    RespStatus status = resp_detail::parseLine(pos, end, '*', count);
+    if (status != RespStatus::Complete) {
+        return status;
+    }
+    if (count <= 0 || count > resp_detail::MaxArrayLength) {
+        return RespStatus::Error;
+    }
+    args.clear();
+    for (int64_t i = 0; i < count; ++i) {
+        std::string_view arg;
+        status = resp_detail::parseBulk(pos, end, &arg);
+        if (status != RespStatus::Complete) {
+            return status;
+        }
+        args.push_back(arg);
+    }
+    consumed = static_cast<size_t>(pos - begin);
+    return RespStatus::Complete;
+}
+
+// Skips one reply in [begin, end), reporting whether it was an error reply.
+inline RespStatus parseRespReply(const char *begin, const char *end, size_t &consumed,
+                                 bool &isError) {
+    const char *pos = begin;
+    if (pos == end) {
+        return RespStatus::Incomplete;
+    }
+    isError = *pos == '-';
+    RespStatus status;
+    int64_t value;
+    switch (*pos) {
+      case '+':
+      case '-': {
+        const char *eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        if (eol == nullptr) {
+            return RespStatus::Incomplete;
+        }
+        pos = eol + 1;
+        status = RespStatus::Complete;
+        break;
+      }
+      case ':':
+        status = resp_detail::parseLine(pos, end, ':', value);
+        break;
+      case '$':
+        status = resp_detail::parseBulk(pos, end, nullptr);
+        break;
+      case '*':
+        status = resp_detail::parseLine(pos, end, '*', value);
+        if (status == RespStatus::Complete && value > resp_detail::MaxArrayLength) {
+            return RespStatus::Error;
+        }
+        for (int64_t i = 0; status == RespStatus::Complete && i < value; ++i) {
+            status = resp_detail::parseBulk(pos, end, nullptr);
+        }
+        break;
+      default:
+        return RespStatus::Error;
+    }
+    if (status == RespStatus::Complete) {
+        consumed = static_cast<size_t>(pos - begin);
+    }
+    return status;
+}
+
+inline void appendRespArrayHeader(std::string &out, size_t count) {
+    out += '*';
+    out += std::to_string(count);
+    out += "\r\n";
+}
+
+inline void appendRespBulk(std::string &out, std::string_view value) {
+    out += '$';
+    out += std::to_string(value.size());
+    out += "\r\n";
+    out.append(value.data(), value.size());
+    out += "\r\n";
+}
+
+inline void appendRespNull(std::string &out) {
+    out += "$-1\r\n";
+}
+
+inline void appendRespInteger(std::string &out, int64_t value) {
+    out += ':';
+    out += std::to_string(value);
+    out += "\r\n";
+}
+
+inline void appendRespSimple(std::string &out, std::string_view value) {
+    out += '+';
+    out.append(value.data(), value.size());
+    out += "\r\n";
+}
+
+inline void appendRespError(std::string &out, std::string_view message) {
+    out += "-ERR ";
+    out.append(message.data(), message.size());
+    out += "\r\n";
+}
+
+inline void appendRespCommand(std::string &out, const std::vector<std::string_view> &args) {
+    appendRespArrayHeader(out, args.size());
+    for (auto arg : args) {
+        appendRespBulk(out, arg);
+    }
+}
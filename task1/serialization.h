@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Byte-level encoding of keys and values for the storage layers built on
+// top of HashMap. Trivially copyable types are stored as raw bytes,
+// strings are stored as a 32-bit length followed by the characters.
+template<class T, class Enable = void>
+struct Serializer;
+
+template<class T>
+struct Serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+    static void write(std::string &out, const T &value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static bool read(const char *&pos, const char *end, T &value) {
+        if (static_cast<size_t>(end - pos) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+};
+
+template<>
+struct Serializer<std::string> {
+    static void write(std::string &out, const std::string &value) {
+        Serializer<uint32_t>::write(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    static bool read(const char *&pos, const char *end, std::string &value) {
+        uint32_t length;
+        if (!Serializer<uint32_t>::read(pos, end, length) ||
+            static_cast<size_t>(end - pos) < length) {
+            return false;
+        }
+        value.assign(pos, length);
+        pos += length;
+        return true;
+    }
+};
+
+template<class First, class Second>
+struct Serializer<std::pair<First, Second>,
+    typename std::enable_if<!std::is_trivially_copyable<std::pair<First, Second>>::value>::type> {
+    static void write(std::string &out, const std::pair<First, Second> &value) {
+        Serializer<typename std::remove_const<First>::type>::write(out, value.first);
+        Serializer<Second>::write(out, value.second);
+    }
+
+    static bool read(const char *&pos, const char *end, std::pair<First, Second> &value) {
+        return Serializer<typename std::remove_const<First>::type>::read(
+                   pos, end, const_cast<typename std::remove_const<First>::type&>(value.first)) &&
+               Serializer<Second>::read(pos, end, value.second);
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "task1.h"
+
+// A fixed number of independently locked HashMap shards; a key always lives
+// in shard hasher(key) % shard_count(). Readers of a shard share its lock.
+//
+// Every shard carries a generation that writers bump before releasing its
+// lock. find_cached() answers repeated lookups from a small direct-mapped
+// cache private to the calling thread, whose entries are only trusted while
+// their shard's generation is unchanged.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType> >
+class ShardedHashMap {
+  private:
+    static const size_t FrontCacheEntries = 1024;
+
+    using ShardMap = HashMap<KeyType, ValueType, Hash>;
+
+    struct Shard {
+        std::shared_mutex lock;
+        std::atomic<uint64_t> generation{0};
+        ShardMap map;
+
+        explicit Shard(Hash hasher) : map(hasher) {}
+    };
+
+    struct GenerationBump {
+        std::atomic<uint64_t> &generation;
+
+        ~GenerationBump() {
+            generation.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+    struct FrontCacheEntry {
+        uint64_t owner = 0;
+        uint64_t generation = 0;
+        size_t hash = 0;
+        KeyType key = KeyType();
+        ValueType value = ValueType();
+        bool found = false;
+    };
+
+    Hash hasher;
+    std::vector<std::unique_ptr<Shard>> shards;
+    // distinguishes this map in the thread-local caches, which are shared
+    // by all maps of the same type; never reused, unlike addresses
+    uint64_t id;
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    static std::vector<FrontCacheEntry>& frontCache() {
+        static thread_local std::vector<FrontCacheEntry> cache(FrontCacheEntries);
+        return cache;
+    }
+
+    // runs fn with the shard locked and bumps its generation afterwards
+    template<class Function>
+    auto locked(size_t index, Function fn) -> decltype(fn(shards[0]->map)) {
+        Shard &shard = *shards[index];
+        std::unique_lock<std::shared_mutex> guard(shard.lock);
+        GenerationBump bump{shard.generation};
+        return fn(shard.map);
+    }
+
+    // runs fn with the shard's lock shared by other readers
+    template<class Function>
+    auto lockedShared(size_t index, Function fn) const
+        -> decltype(fn(static_cast<const ShardMap&>(shards[0]->map))) {
+        Shard &shard = *shards[index];
+        std::shared_lock<std::shared_mutex> guard(shard.lock);
+        return fn(static_cast<const ShardMap&>(shard.map));
+    }
+
+  public:
+    explicit ShardedHashMap(size_t shardCount, Hash _hasher = Hash()) :
+        hasher(_hasher), id(nextId()) {
+        for (size_t i = 0; i < (shardCount == 0 ? 1 : shardCount); ++i) {
+            shards.emplace_back(new Shard(_hasher));
+        }
+    }
+
+    size_t shard_count() const {
+        return shards.size();
+    }
+
+    size_t shard_of(const KeyType &key) const {
+        return hasher(key) % shards.size();
+    }
+
+    // Runs fn(HashMap&) with the key's shard locked and returns its result.
+    // Counts as a write: it invalidates the shard's front cache entries.
+    template<class Function>
+    auto with_shard(const KeyType &key, Function fn) -> decltype(fn(shards[0]->map)) {
+        return locked(shard_of(key), fn);
+    }
+
+    // Runs fn(const HashMap&) with the key's shard locked for reading only,
+    // so that it runs beside other readers and keeps the front caches.
+    template<class Function>
+    auto with_shard_read(const KeyType &key, Function fn) const
+        -> decltype(fn(static_cast<const ShardMap&>(shards[0]->map))) {
+        return lockedShared(shard_of(key), fn);
+    }
+
+    bool get(const KeyType &key, ValueType &value) const {
+        return lockedShared(shard_of(key), [&](const ShardMap &map) {
+            auto it = map.find(key);
+            if (it == map.end()) {
+                return false;
+            }
+            value = it->second;
+            return true;
+        });
+    }
+
+    // Same as get(), but served from the calling thread's front cache when
+    // the key was looked up before and its shard has not been written since.
+    bool find_cached(const KeyType &key, ValueType &value) {
+        size_t hash = hasher(key);
+        size_t index = hash % shards.size();
+        Shard &shard = *shards[index];
+        FrontCacheEntry &entry = frontCache()[FibonacciMix::mix(hash) & (FrontCacheEntries - 1)];
+        if (entry.owner == id && entry.hash == hash &&
+            entry.generation == shard.generation.load(std::memory_order_acquire) &&
+            entry.key == key) {
+            if (entry.found) {
+                value = entry.value;
+            }
+            return entry.found;
+        }
+
+        std::shared_lock<std::shared_mutex> guard(shard.lock);
+        const ShardMap &map = shard.map;
+        auto it = map.find(key);
+        entry.owner = id;
+        entry.generation = shard.generation.load(std::memory_order_relaxed);
+        entry.hash = hash;
+        entry.key = key;
+        entry.found = it != map.end();
+        if (entry.found) {
+            entry.value = it->second;
+            value = it->second;
+        }
+        return entry.found;
+    }
+
+    void set(const KeyType &key, const ValueType &value) {
+        with_shard(key, [&](ShardMap &map) {
+            map[key] = value;
+        });
+    }
+
+    bool erase(const KeyType &key) {
+        return with_shard(key, [&](ShardMap &map) {
+            size_t before = map.size();
+            map.erase(key);
+            return map.size() != before;
+        });
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (auto &shard : shards) {
+            std::shared_lock<std::shared_mutex> guard(shard->lock);
+            total += shard->map.size();
+        }
+        return total;
+    }
+};
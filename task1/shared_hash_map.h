@@ -0,0 +1,382 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Chained hash map living in one shared memory segment, so that several
+// processes can read and update the same table. Nodes are addressed by
+// offsets from the segment start and carved from the segment itself; every
+// shard of buckets is guarded by a process-shared mutex and keeps its own
+// free list. The bucket count is fixed at creation.
+//
+// The mutexes are robust: if a process dies holding one, the next process
+// to lock it takes it over. Every update links or unlinks its node with a
+// single store, so the chains are intact after such a death; at worst the
+// node being inserted or erased is leaked, size() is off by one, or a value
+// written by assign() or update() is left half written.
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+class SharedHashMap {
+    static_assert(std::is_trivially_copyable<KeyType>::value &&
+                  std::is_trivially_copyable<ValueType>::value,
+                  "SharedHashMap stores keys and values by their bytes");
+
+  private:
+    static constexpr uint64_t Magic = 0x50414d4853485332ull;
+
+    struct Node {
+        uint64_t next;
+        KeyType key;
+        ValueType value;
+    };
+
+    struct alignas(64) Shard {
+        pthread_mutex_t lock;
+        uint64_t freeList;
+    };
+
+    struct Header {
+        std::atomic<uint64_t> magic;
+        uint64_t segmentSize;
+        uint64_t bucketCount;
+        uint64_t shardCount;
+        uint64_t shardsOffset;
+        uint64_t bucketsOffset;
+        std::atomic<uint64_t> heapTop;
+        std::atomic<uint64_t> keyCount;
+    };
+
+    Hash hasher;
+    char *base = nullptr;
+    size_t mappedSize = 0;
+
+    Header* header() const {
+        return reinterpret_cast<Header*>(base);
+    }
+
+    Shard& shardOf(uint64_t bucket) const {
+        return reinterpret_cast<Shard*>(base + header()->shardsOffset)[bucket % header()->shardCount];
+    }
+
+    uint64_t& bucketHead(uint64_t bucket) const {
+        return reinterpret_cast<uint64_t*>(base + header()->bucketsOffset)[bucket];
+    }
+
+    Node* node(uint64_t offset) const {
+        return reinterpret_cast<Node*>(base + offset);
+    }
+
+    uint64_t bucketIndex(const KeyType &key) const {
+        return hasher(key) % header()->bucketCount;
+    }
+
+    static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static void fail(const std::string &what) {
+        throw std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    // the caller holds the shard's lock
+    uint64_t allocate(Shard &shard) {
+        if (shard.freeList != 0) {
+            uint64_t offset = shard.freeList;
+            shard.freeList = node(offset)->next;
+            return offset;
+        }
+        // a failed allocation must leave heapTop where it was, or a smaller
+        // request could no longer use the space
+        uint64_t offset = header()->heapTop.load(std::memory_order_relaxed);
+        do {
+            if (offset + sizeof(Node) > header()->segmentSize) {
+                throw std::bad_alloc();
+            }
+        } while (!header()->heapTop.compare_exchange_weak(
+                     offset, offset + alignUp(sizeof(Node), alignof(Node)),
+                     std::memory_order_relaxed));
+        return offset;
+    }
+
+    void map(int fd, size_t size) {
+        void *address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            fail("Cannot map shared segment");
+        }
+        base = static_cast<char*>(address);
+        mappedSize = size;
+    }
+
+    void initialize(size_t size, size_t bucketCount, size_t shardCount) {
+        Header *h = header();
+        h->segmentSize = size;
+        h->bucketCount = bucketCount == 0 ? 1 : bucketCount;
+        h->shardCount = shardCount == 0 ? 1 : shardCount;
+        h->shardsOffset = alignUp(sizeof(Header), alignof(Shard));
+        h->bucketsOffset = alignUp(h->shardsOffset + h->shardCount * sizeof(Shard), 64);
+        uint64_t heapStart = alignUp(h->bucketsOffset + h->bucketCount * sizeof(uint64_t), 64);
+        if (heapStart >= size) {
+            throw std::invalid_argument("Shared segment is too small for the bucket array");
+        }
+        new (&h->heapTop) std::atomic<uint64_t>(heapStart);
+        new (&h->keyCount) std::atomic<uint64_t>(0);
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        for (uint64_t i = 0; i < h->shardCount; ++i) {
+            Shard *shard = reinterpret_cast<Shard*>(base + h->shardsOffset) + i;
+            pthread_mutex_init(&shard->lock, &attr);
+            shard->freeList = 0;
+        }
+        pthread_mutexattr_destroy(&attr);
+        // a fresh segment is zero-filled, so every bucket already reads as empty
+        h->magic.store(Magic, std::memory_order_release);
+    }
+
+    // links a node into its place; the compiler may not sink the writes
+    // that fill the node below the store, which a process dying in between
+    // would otherwise leave published half written
+    static void publish(uint64_t &link, uint64_t offset) {
+        std::atomic_signal_fence(std::memory_order_release);
+        link = offset;
+    }
+
+    class ShardLock {
+        pthread_mutex_t *lock;
+      public:
+        explicit ShardLock(Shard &shard) : lock(&shard.lock) {
+            int result = pthread_mutex_lock(lock);
+            if (result == EOWNERDEAD) {
+                // the owner died inside its critical section; see above
+                pthread_mutex_consistent(lock);
+            } else if (result != 0) {
+                errno = result;
+                fail("Cannot lock shard");
+            }
+        }
+        ~ShardLock() {
+            pthread_mutex_unlock(lock);
+        }
+    };
+
+    SharedHashMap(int fd, size_t size, size_t bucketCount, size_t shardCount, bool create,
+                  Hash _hasher) : hasher(_hasher) {
+        if (create) {
+            if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                fail("Cannot size shared segment");
+            }
+            map(fd, size);
+            initialize(size, bucketCount, shardCount);
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            fail("Cannot stat shared segment");
+        }
+        map(fd, static_cast<size_t>(st.st_size));
+        if (mappedSize < sizeof(Header) ||
+            header()->magic.load(std::memory_order_acquire) != Magic) {
+            ::munmap(base, mappedSize);
+            base = nullptr;
+            throw std::runtime_error("Shared segment is not an initialized SharedHashMap");
+        }
+    }
+
+  public:
+    // Creates a named segment of size bytes with bucketCount buckets split
+    // into shardCount lock shards. Fails if the name already exists.
+    static SharedHashMap create(const std::string &name, size_t size, size_t bucketCount,
+                                size_t shardCount = 64, Hash _hasher = Hash()) {
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            fail("Cannot create shared segment " + name);
+        }
+        try {
+            SharedHashMap result(fd, size, bucketCount, shardCount, true, _hasher);
+            ::close(fd);
+            return result;
+        } catch (...) {
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw;
+        }
+    }
+
+    // Attaches to a segment created by another process.
+    static SharedHashMap open(const std::string &name, Hash _hasher = Hash()) {
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            fail("Cannot open shared segment " + name);
+        }
+        try {
+            SharedHashMap result(fd, 0, 0, 0, false, _hasher);
+            ::close(fd);
+            return result;
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    // Creates a map in an anonymous file such as one from memfd_create();
+    // the descriptor can be passed to other processes, which attach with
+    // from_fd(fd, false).
+    static SharedHashMap from_fd(int fd, bool create, size_t size = 0, size_t bucketCount = 0,
+                                 size_t shardCount = 64, Hash _hasher = Hash()) {
+        return SharedHashMap(fd, size, bucketCount, shardCount, create, _hasher);
+    }
+
+    static void unlink(const std::string &name) {
+        ::shm_unlink(name.c_str());
+    }
+
+    SharedHashMap(SharedHashMap &&other) noexcept :
+        hasher(other.hasher), base(other.base), mappedSize(other.mappedSize) {
+        other.base = nullptr;
+        other.mappedSize = 0;
+    }
+
+    SharedHashMap(const SharedHashMap&) = delete;
+    SharedHashMap& operator=(const SharedHashMap&) = delete;
+
+    ~SharedHashMap() {
+        if (base != nullptr) {
+            ::munmap(base, mappedSize);
+        }
+    }
+
+    size_t size() const {
+        return header()->keyCount.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t bucket_count() const {
+        return header()->bucketCount;
+    }
+
+    // Returns false if the key is already present.
+    bool insert(const KeyType &key, const ValueType &value) {
+        uint64_t bucket = bucketIndex(key);
+        Shard &shard = shardOf(bucket);
+        ShardLock lock(shard);
+        uint64_t &head = bucketHead(bucket);
+        for (uint64_t it = head; it != 0; it = node(it)->next) {
+            if (node(it)->key == key) {
+                return false;
+            }
+        }
+        uint64_t offset = allocate(shard);
+        Node *created = node(offset);
+        created->next = head;
+        created->key = key;
+        created->value = value;
+        publish(head, offset);
+        header()->keyCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Inserts or overwrites.
+    void assign(const KeyType &key, const ValueType &value) {
+        uint64_t bucket = bucketIndex(key);
+        Shard &shard = shardOf(bucket);
+        ShardLock lock(shard);
+        uint64_t &head = bucketHead(bucket);
+        for (uint64_t it = head; it != 0; it = node(it)->next) {
+            if (node(it)->key == key) {
+                node(it)->value = value;
+                return;
+            }
+        }
+        uint64_t offset = allocate(shard);
+        Node *created = node(offset);
+        created->next = head;
+        created->key = key;
+        created->value = value;
+        publish(head, offset);
+        header()->keyCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Calls fn(ValueType&) under the shard's lock. Returns false if
+    // the key is absent.
+    template<class Function>
+    bool update(const KeyType &key, Function fn) {
+        uint64_t bucket = bucketIndex(key);
+        ShardLock lock(shardOf(bucket));
+        for (uint64_t it = bucketHead(bucket); it != 0; it = node(it)->next) {
+            if (node(it)->key == key) {
+                fn(node(it)->value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool erase(const KeyType &key) {
+        uint64_t bucket = bucketIndex(key);
+        Shard &shard = shardOf(bucket);
+        ShardLock lock(shard);
+        uint64_t *link = &bucketHead(bucket);
+        while (*link != 0) {
+            Node *current = node(*link);
+            if (current->key == key) {
+                uint64_t offset = *link;
+                *link = current->next;
+                current->next = shard.freeList;
+                shard.freeList = offset;
+                header()->keyCount.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            link = &current->next;
+        }
+        return false;
+    }
+
+    // Copies the value out under the shard's lock.
+    bool find(const KeyType &key, ValueType &value) const {
+        uint64_t bucket = bucketIndex(key);
+        ShardLock lock(shardOf(bucket));
+        for (uint64_t it = bucketHead(bucket); it != 0; it = node(it)->next) {
+            if (node(it)->key == key) {
+                value = node(it)->value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool contains(const KeyType &key) const {
+        ValueType value;
+        return find(key, value);
+    }
+
+    // Visits every element, holding one shard's lock at a time.
+    template<class Function>
+    void for_each(Function fn) const {
+        uint64_t shardCount = header()->shardCount;
+        for (uint64_t s = 0; s < shardCount; ++s) {
+            ShardLock lock(shardOf(s));
+            for (uint64_t bucket = s; bucket < header()->bucketCount; bucket += shardCount) {
+                for (uint64_t it = bucketHead(bucket); it != 0; it = node(it)->next) {
+                    fn(static_cast<const KeyType&>(node(it)->key),
+                       static_cast<const ValueType&>(node(it)->value));
+                }
+            }
+        }
+    }
+};
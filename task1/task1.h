@@ -1,35 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
 #include <vector>
 #include <initializer_list>
 #include <list>
+#include <random>
 #include <stdexcept>
 #include <iterator>
-
-template<class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+#include <type_traits>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "batch_hash.h"
+#include "composite_hash.h"
+#include "hash_policies.h"
+
+// Outcome of one HashMap::compact() step.
+enum class CompactStatus {
+    Running,
+    Done,
+    // the map is pinned; nothing was moved
+    Pinned
+};
+
+// How find() reorders a chain on a hit: not at all, by moving the found
+// element to the front, or by swapping it with its predecessor.
+enum class BucketOrganization {
+    None,
+    MoveToFront,
+    Transpose
+};
+
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType>,
+         class Policy = DefaultHashPolicy>
 class HashMap {
     using MyPair = typename std::pair<const KeyType, ValueType>;
+    using Bucket = std::list<MyPair, typename Policy::template Allocator<MyPair>>;
+    using IndexMapping = typename Policy::IndexMapping;
+    using Growth = typename Policy::Growth;
+    using PostMix = typename Policy::PostMix;
 
   private:
+    static constexpr size_t BatchSize = 32;
+
     Hash hasher;
 
-    std::vector<std::list<MyPair>> data;
+    std::vector<Bucket> data;
     size_t keyCount = 0;
+    // at least the length of the longest chain; erasures do not lower it,
+    // rehashing, shrink_to_fit() and a finished compact() pass do
+    size_t chainBound = 0;
+    BucketOrganization organization = BucketOrganization::None;
+    // while pinned, resizing and relocation are deferred and chains may
+    // grow past the load factor
+    size_t pins = 0;
+    bool shrinkDeferred = false;
+    bool shrinkToFitDeferred = false;
+    bool layoutDeferred = false;
+    size_t reserveDeferred = 0;
+    // next bucket of an unfinished compact() pass, and the nodes it moved
+    // away from, kept allocated until the pass ends
+    size_t compactCursor = 0;
+    std::vector<Bucket> compactRetired;
+    // longest chain seen by the current compact() pass, or grown since
+    size_t compactBound = 0;
+
+    static size_t reverseBits(size_t value) {
+        size_t shift = sizeof(size_t) * 8;
+        size_t mask = ~size_t(0);
+        while ((shift >>= 1) > 0) {
+            mask ^= (mask << shift);
+            value = ((value >> shift) & mask) | ((value << shift) & ~mask);
+        }
+        return value;
+    }
 
-    const double MaxLoadFactor = 1.618033988; // Golden ratio
-    const double MinLoadFactor = MaxLoadFactor * MaxLoadFactor;
-
+    // moves the nodes over, so no element is copied
     void rehash(const size_t bucketSize) {
-        std::vector<std::list<MyPair>> old_data(std::move(data));
-        keyCount = 0;
-        data.resize(bucketSize);
-        for (const auto &bucket : old_data) {
-            for (const auto &element : bucket) {
-                insert(element);
+        std::vector<Bucket> old_data(std::move(data));
+        data.clear();
+        data.resize(IndexMapping::bucketCount(bucketSize));
+        for (auto &bucket : old_data) {
+            while (!bucket.empty()) {
+                auto &target = data[bucketIndex(bucket.front().first)];
+                target.splice(target.end(), bucket, bucket.begin());
             }
         }
+        recomputeChainBound();
+        compactCursor = 0;
+        compactRetired.clear();
+        compactBound = 0;
+    }
+
+    void recomputeChainBound() {
+        chainBound = 0;
+        for (const auto &bucket : data) {
+            chainBound = std::max(chainBound, bucket.size());
+        }
     }
 
     size_t bucketIndex(const KeyType &key) const {
-        return hasher(key) % data.size();
+        return hashIndex(hasher(key));
+    }
+
+    size_t hashIndex(const size_t hash) const {
+        return IndexMapping::index(PostMix::mix(hash), data.size());
+    }
+
+    void insertHashed(const MyPair &v, const size_t hash) {
+        auto &bucket = data[hashIndex(hash)];
+
+        for (const auto &element : bucket) {
+            if (element.first == v.first) {
+                return;
+            }
+        }
+        bucket.push_back(v);
+        ++keyCount;
+        chainBound = std::max(chainBound, bucket.size());
+        compactBound = std::max(compactBound, bucket.size());
+        growIfNeeded();
+    }
+
+    void eraseHashed(const KeyType &key, const size_t hash) {
+        auto &bucket = data[hashIndex(hash)];
+
+        auto it = bucket.begin();
+        while (it != bucket.end() && it->first != key) {
+            ++it;
+        }
+        if (it == bucket.end()) {
+            return;
+        }
+
+        bucket.erase(it);
+        --keyCount;
+        shrinkIfNeeded();
+    }
+
+    // a caller-supplied hash must be the one hash_function() gives
+    template<class Probe>
+    void checkHash(const Probe &key, const size_t hash) const {
+        assert(hasher(key) == hash && "hash differs from hash_function()(key)");
+        static_cast<void>(key);
+        static_cast<void>(hash);
+    }
+
+    void growIfNeeded() {
+        if (pins == 0 && Growth::shouldGrow(keyCount, data.size())) {
+            rehash(Growth::bucketsFor(keyCount));
+        }
+    }
+
+    void shrinkIfNeeded() {
+        if (pins != 0) {
+            shrinkDeferred = true;
+            return;
+        }
+        if (Growth::shouldShrink(keyCount, data.size())) {
+            size_t bucketSize = IndexMapping::bucketCount(Growth::bucketsFor(keyCount));
+            if (bucketSize < data.size()) {
+                rehash(bucketSize);
+            }
+        }
+    }
+
+    // Node relocation in two steps, so that an exception leaves the map as
+    // it was: allocateChain() builds new nodes with the bucket's allocator,
+    // holding copies of the keys and, unless the values can be moved
+    // without throwing, of the values; fillChain() then moves the values.
+    static constexpr bool RelocateByMove = std::is_nothrow_move_assignable<ValueType>::value &&
+                                           std::is_default_constructible<ValueType>::value;
+
+    static Bucket allocateChain(const Bucket &bucket) {
+        Bucket relocated(bucket.get_allocator());
+        for (const auto &element : bucket) {
+            if constexpr (RelocateByMove) {
+                relocated.emplace_back(element.first, ValueType());
+            } else {
+                relocated.push_back(element);
+            }
+        }
+        return relocated;
+    }
+
+    static void fillChain(Bucket &relocated, Bucket &bucket) noexcept {
+        if constexpr (RelocateByMove) {
+            auto target = relocated.begin();
+            for (auto &element : bucket) {
+                (target++)->second = std::move(element.second);
+            }
+        }
+    }
+
+    // the work put off while pinned, once the last guard is gone
+    void runDeferred() {
+        if (shrinkToFitDeferred) {
+            shrinkToFitDeferred = false;
+            shrink_to_fit();
+        }
+        if (reserveDeferred != 0) {
+            size_t count = reserveDeferred;
+            reserveDeferred = 0;
+            reserve(count);
+        }
+        growIfNeeded();
+        if (shrinkDeferred) {
+            shrinkDeferred = false;
+            shrinkIfNeeded();
+        }
+        if (layoutDeferred) {
+            layoutDeferred = false;
+            optimize_layout();
+        }
+    }
+
+    // bucket and position of a uniformly chosen element of a non-empty map:
+    // positions are drawn below chainBound until one exists. A chainBound
+    // left far above the chains by erasures makes misses likely, so after
+    // bucket_count() of them, which costs about as much as a walk over the
+    // buckets, the element of a random rank is looked up by that walk.
+    template<class URBG>
+    std::pair<size_t, size_t> randomPosition(URBG &generator) const {
+        std::uniform_int_distribution<size_t> bucketDistribution(0, data.size() - 1);
+        std::uniform_int_distribution<size_t> positionDistribution(0, chainBound - 1);
+        for (size_t draw = 0; draw < data.size(); ++draw) {
+            size_t index = bucketDistribution(generator);
+            size_t position = positionDistribution(generator);
+            if (position < data[index].size()) {
+                return {index, position};
+            }
+        }
+        size_t rank = std::uniform_int_distribution<size_t>(0, keyCount - 1)(generator);
+        size_t index = 0;
+        while (rank >= data[index].size()) {
+            rank -= data[index].size();
+            ++index;
+        }
+        return {index, rank};
+    }
+
+    // Walks buckets in order while the first nodes of the next lookahead
+    // buckets and the successor of the visited node are already being
+    // fetched, so that misses of different chains overlap.
+    template<class Buckets, class Function>
+    static void forEachPrefetched(Buckets &buckets, Function &fn, const size_t lookahead) {
+        const size_t count = buckets.size();
+        for (size_t i = 0; i < count && i < lookahead; ++i) {
+            if (!buckets[i].empty()) {
+                HASHMAP_PREFETCH(&buckets[i].front());
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (i + lookahead < count && !buckets[i + lookahead].empty()) {
+                HASHMAP_PREFETCH(&buckets[i + lookahead].front());
+            }
+            auto &bucket = buckets[i];
+            for (auto it = bucket.begin(); it != bucket.end();) {
+                auto next = std::next(it);
+                if (next != bucket.end()) {
+                    HASHMAP_PREFETCH(&*next);
+                }
+                fn(*it);
+                it = next;
+            }
+        }
     }
 
   public:
@@ -40,7 +278,7 @@ class HashMap {
     template<typename iter>
     HashMap(iter begin, iter end, Hash _hasher = Hash()) : hasher(_hasher) {
         clear();
-        rehash(std::distance(begin, end) * MaxLoadFactor + 1);
+        rehash(Growth::bucketsFor(std::distance(begin, end)));
         for (auto it = begin; it != end; ++it) {
             insert(*it);
         }
@@ -49,7 +287,7 @@ class HashMap {
     HashMap(const std::initializer_list<MyPair> &list,
             Hash _hasher = Hash()) : hasher(_hasher) {
         clear();
-        rehash(std::distance(list.begin(), list.end()) * MaxLoadFactor + 1);
+        rehash(Growth::bucketsFor(list.size()));
         for (auto it = list.begin(); it != list.end(); ++it) {
             insert(*it);
         }
@@ -64,11 +302,15 @@ class HashMap {
         }
     }
 
+    // Like clear(), ends every iteration over a pinned map; the bucket
+    // array is then only resized when the last guard goes away.
     HashMap& operator=(const HashMap &other) {
         if (&other != this) {
             hasher = other.hasher;
             clear();
-            rehash(other.data.size());
+            if (pins == 0) {
+                rehash(other.data.size());
+            }
             for (const auto &it : other) {
                 insert(it);
             }
@@ -76,6 +318,20 @@ class HashMap {
         return *this;
     }
 
+    // Exchanges the contents; pins stay with their map, so neither may be
+    // pinned.
+    void swap(HashMap &other) noexcept {
+        assert(pins == 0 && other.pins == 0 && "swap() of a pinned HashMap");
+        std::swap(hasher, other.hasher);
+        data.swap(other.data);
+        std::swap(keyCount, other.keyCount);
+        std::swap(chainBound, other.chainBound);
+        std::swap(organization, other.organization);
+        std::swap(compactCursor, other.compactCursor);
+        compactRetired.swap(other.compactRetired);
+        std::swap(compactBound, other.compactBound);
+    }
+
     Hash hash_function() const {
         return hasher;
     }
@@ -88,37 +344,122 @@ class HashMap {
         return (size() == 0);
     }
 
+    size_t bucket_count() const {
+        return data.size();
+    }
+
+    size_t bucket(const KeyType &key) const {
+        return bucketIndex(key);
+    }
+
+    size_t bucket_size(const size_t index) const {
+        return data[index].size();
+    }
+
+    void reserve(const size_t count) {
+        if (pins != 0) {
+            reserveDeferred = std::max(reserveDeferred, count);
+            return;
+        }
+        size_t bucketSize = IndexMapping::bucketCount(Growth::bucketsFor(count));
+        if (bucketSize > data.size()) {
+            rehash(bucketSize);
+        }
+    }
+
     void insert(const MyPair &v) {
-        auto &bucket = data[bucketIndex(v.first)];
+        insertHashed(v, hasher(v.first));
+    }
 
-        for (const auto &element : bucket) {
-            if (element.first == v.first) {
-                return;
+    // Same as insert(v) for a hash computed earlier as
+    // hash_function()(v.first), e.g. when one key goes into several maps
+    // with the same hasher; checked in debug builds.
+    void insert_hashed(const MyPair &v, const size_t hash) {
+        checkHash(v.first, hash);
+        insertHashed(v, hash);
+    }
+
+    // Inserts count elements, hashing them in blocks with the hasher's
+    // batch kernel when it has one (see BatchHash) and the keys are
+    // trivially copyable, as the kernels want them next to each other.
+    // Room for count new keys is reserved up front, so a batch of mostly
+    // duplicate or present keys may leave more buckets than needed.
+    void insert_batch(const MyPair *elements, const size_t count) {
+        reserve(keyCount + count);
+        constexpr bool Gather = has_hash_batch<Hash, KeyType>::value &&
+                                std::is_trivially_copyable<KeyType>::value &&
+                                std::is_default_constructible<KeyType>::value;
+        if constexpr (!Gather) {
+            for (size_t i = 0; i < count; ++i) {
+                insert(elements[i]);
+            }
+        } else {
+            KeyType keys[BatchSize];
+            uint64_t hashes[BatchSize];
+            for (size_t start = 0; start < count; start += BatchSize) {
+                size_t block = std::min(BatchSize, count - start);
+                for (size_t i = 0; i < block; ++i) {
+                    keys[i] = elements[start + i].first;
+                }
+                hash_batch(hasher, keys, block, hashes);
+                for (size_t i = 0; i < block; ++i) {
+                    insertHashed(elements[start + i], static_cast<size_t>(hashes[i]));
+                }
             }
         }
-        bucket.push_back(v);
-        ++keyCount;
-        if (keyCount >= data.size()) {
-            rehash(static_cast<size_t>(keyCount * MaxLoadFactor + 1));
+    }
+
+    // Looks up count keys and stores a pointer to each value, or nullptr,
+    // in values; returns the number of keys found. The keys of a block are
+    // hashed together, their buckets prefetched, and then the first node of
+    // each chain, before any is searched.
+    size_t find_batch(const KeyType *keys, const size_t count, ValueType **values) {
+        size_t found = 0;
+        uint64_t hashes[BatchSize];
+        size_t indices[BatchSize];
+        for (size_t start = 0; start < count; start += BatchSize) {
+            size_t block = std::min(BatchSize, count - start);
+            hash_batch(hasher, keys + start, block, hashes);
+            for (size_t i = 0; i < block; ++i) {
+                indices[i] = hashIndex(hashes[i]);
+                HASHMAP_PREFETCH(&data[indices[i]]);
+            }
+            for (size_t i = 0; i < block; ++i) {
+                if (!data[indices[i]].empty()) {
+                    HASHMAP_PREFETCH(&data[indices[i]].front());
+                }
+            }
+            for (size_t i = 0; i < block; ++i) {
+                ValueType *value = nullptr;
+                for (auto &element : data[indices[i]]) {
+                    if (element.first == keys[start + i]) {
+                        value = &element.second;
+                        ++found;
+                        break;
+                    }
+                }
+                values[start + i] = value;
+            }
         }
+        return found;
     }
 
     void erase(const KeyType& key) {
-        auto &bucket = data[bucketIndex(key)];
+        eraseHashed(key, hasher(key));
+    }
 
-        auto it = bucket.begin();
-        while (it != bucket.end() && it->first != key) {
-            ++it;
-        }
-        if (it == bucket.end()) {
-            return;
-        }
+    void erase(const KeyType &key, const size_t hash) {
+        checkHash(key, hash);
+        eraseHashed(key, hash);
+    }
 
-        bucket.erase(it);
-        --keyCount;
-        if (keyCount * MinLoadFactor < bucket.size()) {
-            //if the number of blocks needs to be recalculated
-            rehash(static_cast<size_t>(keyCount * MaxLoadFactor + 1));
+    // Starts loading the first node of the chain a lookup with this hash
+    // searches. Finding the node reads the bucket, so when prefetching many
+    // hashes it pays to touch all of their buckets first.
+    void prefetch(const size_t hash) const {
+        const Bucket &bucket = data[hashIndex(hash)];
+        if (!bucket.empty()) {
+            HASHMAP_PREFETCH(&bucket.front());
         }
     }
 
@@ -131,6 +472,14 @@ class HashMap {
         return it->second;
     }
 
+    ValueType& at(const KeyType& key) {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("There is no such key");
+        }
+        return it->second;
+    }
+
     const ValueType& at(const KeyType& key) const {
         auto &bucket = data[bucketIndex(key)];
 
@@ -143,18 +492,235 @@ class HashMap {
         throw std::out_of_range("There is no such key");
     }
 
+    // Visits the elements of a few buckets, at least count elements unless
+    // the table ends first, and returns the cursor to resume from; a scan
+    // starts and ends at cursor 0. The cursor walks bucket indices in
+    // reverse-bit order, so every element present for the whole scan is
+    // visited at least once even if the table is rehashed between calls.
+    template<class Function>
+    size_t scan(size_t cursor, const size_t count, Function fn) const {
+        static_assert(IndexMapping::PowerOfTwo, "scan() needs power-of-two bucket counts");
+        const size_t mask = data.size() - 1;
+        size_t visited = 0;
+        do {
+            for (const auto &element : data[cursor & mask]) {
+                fn(element);
+                ++visited;
+            }
+            cursor |= ~mask;
+            cursor = reverseBits(reverseBits(cursor) + 1);
+        } while (cursor != 0 && visited < count);
+        return cursor;
+    }
+
+    // Calls fn(element) for every element with software prefetching, which
+    // is faster than iterators for full scans of large maps. fn must not
+    // insert or erase.
+    template<class Function>
+    void for_each(Function fn, const size_t lookahead = 16) {
+        forEachPrefetched(data, fn, lookahead);
+    }
+
+    template<class Function>
+    void for_each(Function fn, const size_t lookahead = 16) const {
+        forEachPrefetched(data, fn, lookahead);
+    }
+
+    // Calls fn(element) for min(count, size()) distinct elements and returns
+    // how many were visited. Buckets are walked in the order of a random
+    // odd stride from a random start, which permutes a power-of-two table;
+    // every element is equally likely to be picked, but elements sharing a
+    // bucket tend to be picked together.
+    template<class URBG, class Function>
+    size_t sample_k(const size_t count, URBG &generator, Function fn) const {
+        static_assert(IndexMapping::PowerOfTwo, "sample_k() needs power-of-two bucket counts");
+        const size_t mask = data.size() - 1;
+        const size_t wanted = std::min(count, keyCount);
+        std::uniform_int_distribution<size_t> distribution(0, mask);
+        size_t index = distribution(generator);
+        const size_t stride = distribution(generator) | 1;
+        size_t visited = 0;
+        while (visited < wanted) {
+            const auto &bucket = data[index];
+            size_t missing = wanted - visited;
+            if (bucket.size() <= missing) {
+                for (const auto &element : bucket) {
+                    fn(element);
+                }
+                visited += bucket.size();
+            } else {
+                // selection sampling keeps the last bucket unbiased
+                size_t remaining = bucket.size();
+                for (auto it = bucket.begin(); missing > 0; ++it, --remaining) {
+                    if (std::uniform_int_distribution<size_t>(1, remaining)(generator) <= missing) {
+                        fn(*it);
+                        --missing;
+                        ++visited;
+                    }
+                }
+            }
+            index = (index + stride) & mask;
+        }
+        return visited;
+    }
+
+    // Keeps the map from resizing itself or relocating nodes while it
+    // exists, so iterators stay valid across insert() and erase() of other
+    // elements; reserve(), shrink_to_fit() and optimize_layout() called
+    // meanwhile are carried out when the last guard goes away. Elements
+    // inserted while iterating may or may not be visited.
+    class RehashGuard {
+      private:
+        HashMap *map;
+
+      public:
+        explicit RehashGuard(HashMap &_map) : map(&_map) {
+            ++map->pins;
+        }
+
+        RehashGuard(RehashGuard &&other) noexcept : map(other.map) {
+            other.map = nullptr;
+        }
+
+        RehashGuard(const RehashGuard &) = delete;
+        RehashGuard& operator=(const RehashGuard &) = delete;
+
+        ~RehashGuard() {
+            release();
+        }
+
+        void release() {
+            if (map == nullptr) {
+                return;
+            }
+            if (--map->pins == 0) {
+                map->runDeferred();
+            }
+            map = nullptr;
+        }
+    };
+
+    RehashGuard pin() {
+        return RehashGuard(*this);
+    }
+
+    bool pinned() const {
+        return pins != 0;
+    }
+
+    // Enables reordering of chains on find(), operator[] and non-const at(),
+    // so that frequently accessed keys end up at the front of their chains.
+    void set_bucket_organization(const BucketOrganization mode) {
+        organization = mode;
+    }
+
+    // Reallocates every node in bucket order, keeping the order within each
+    // chain, so that after heavy churn neighbouring buckets are adjacent in
+    // memory again and each chain starts with its hottest entries when a
+    // self-organizing mode is on. Invalidates all iterators; an exception
+    // leaves the map unchanged.
+    void optimize_layout() {
+        if (pins != 0) {
+            layoutDeferred = true;
+            return;
+        }
+        std::vector<Bucket> rebuilt;
+        rebuilt.reserve(data.size());
+        for (const auto &bucket : data) {
+            rebuilt.push_back(allocateChain(bucket));
+        }
+        for (size_t i = 0; i < data.size(); ++i) {
+            fillChain(rebuilt[i], data[i]);
+        }
+        data.swap(rebuilt);
+    }
+
+    // Keeps the bucket array, so refilling to the same size does not
+    // rehash; use shrink_to_fit() to release it. Takes time linear in
+    // bucket_count() plus size(): every element is a list node of its own
+    // and has to be freed, which a generation stamp on the buckets would
+    // only postpone to their next use. FlatHashMap::clear() is the O(1)
+    // one, for maps that are cleared and refilled at a high rate. On a
+    // pinned map it erases every element, so iterators to them are
+    // invalidated as erase() would, but the bucket array stays in place.
     void clear() {
-        data.clear();
-        data.resize(1);
+        if (data.empty()) {
+            data.resize(1);
+        } else if (keyCount != 0) {
+            for (auto &bucket : data) {
+                bucket.clear();
+            }
+        }
         keyCount = 0;
+        chainBound = 0;
+    }
+
+    void shrink_to_fit() {
+        if (pins != 0) {
+            shrinkToFitDeferred = true;
+            return;
+        }
+        size_t bucketSize = IndexMapping::bucketCount(Growth::bucketsFor(keyCount));
+        if (bucketSize < data.size()) {
+            rehash(bucketSize);
+        } else {
+            recomputeChainBound();
+        }
+    }
+
+    // One bounded step of optimize_layout(), for long-lived maps that cannot
+    // stop for a full rebuild: reallocates the nodes of whole buckets, in
+    // bucket order, until budget elements and visited buckets are used up.
+    // The old nodes stay allocated until the pass is Done, so the new ones
+    // cannot reuse them and end up next to each other once the allocator's
+    // existing holes are used up; node memory peaks at about twice its size
+    // during a pass. At the end of the pass the old nodes are freed and the
+    // allocator is asked to return free pages to the OS. Invalidates
+    // iterators to the moved elements; a resize restarts the pass.
+    CompactStatus compact(const size_t budget) {
+        if (pins != 0) {
+            return CompactStatus::Pinned;
+        }
+        if (compactCursor == 0) {
+            compactBound = 0;
+        }
+        size_t work = 0;
+        while (compactCursor < data.size() && work < budget) {
+            auto &bucket = data[compactCursor++];
+            if (!bucket.empty()) {
+                Bucket relocated = allocateChain(bucket);
+                fillChain(relocated, bucket);
+                // moving the list keeps its allocator with the old nodes
+                compactRetired.push_back(std::move(bucket));
+                bucket.swap(relocated);
+            }
+            compactBound = std::max(compactBound, bucket.size());
+            work += 1 + bucket.size();
+        }
+        if (compactCursor < data.size()) {
+            return CompactStatus::Running;
+        }
+        // every chain was measured by the pass or grew after it was
+        chainBound = compactBound;
+        compactCursor = 0;
+        compactRetired.clear();
+        compactBound = 0;
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+        return CompactStatus::Done;
+    }
+
+    bool compacting() const {
+        return compactCursor != 0;
     }
 
     class iterator : public std::iterator
         <std::forward_iterator_tag, MyPair> {
         using BucketIterator =
-            typename std::vector<std::list<MyPair>>::iterator;
+            typename std::vector<Bucket>::iterator;
         using ElementIterator =
-            typename std::list<MyPair>::iterator;
+            typename Bucket::iterator;
       private:
         BucketIterator bucketIt;
         ElementIterator elementIt;
@@ -188,7 +754,7 @@ class HashMap {
             return *this;
         }
 
-        iterator operator++() {
+        iterator operator++(int) {
             iterator it(*this);
             ++(*this);
             return it;
@@ -214,9 +780,9 @@ class HashMap {
     class const_iterator : public std::iterator
         <std::forward_iterator_tag, const MyPair> {
         using BucketIterator =
-            typename std::vector<std::list<MyPair>>::const_iterator;
+            typename std::vector<Bucket>::const_iterator;
         using ElementIterator =
-            typename std::list<MyPair>::const_iterator;
+            typename Bucket::const_iterator;
       private:
         BucketIterator bucketIt;
         ElementIterator elementIt;
@@ -305,7 +871,29 @@ class HashMap {
     }
 
     iterator find(const KeyType &key) {
-        auto &bucket = data[bucketIndex(key)];
+        return findHashed(key, hasher(key));
+    }
+
+    const_iterator find(const KeyType &key) const {
+        return findHashed(key, hasher(key));
+    }
+
+    // Same as find(key) for a hash computed earlier as hash_function()(key);
+    // checked in debug builds.
+    iterator find(const KeyType &key, const size_t hash) {
+        checkHash(key, hash);
+        return findHashed(key, hash);
+    }
+
+    const_iterator find(const KeyType &key, const size_t hash) const {
+        checkHash(key, hash);
+        return findHashed(key, hash);
+    }
+
+  private:
+    iterator findHashed(const KeyType &key, const size_t hash) {
+        size_t index = hashIndex(hash);
+        auto &bucket = data[index];
 
         auto it = bucket.begin();
         while (it != bucket.end()) {
@@ -318,11 +906,21 @@ class HashMap {
             return end();
         }
 
-        return iterator(data.begin() + bucketIndex(key), it, this);
+        // splicing within a list keeps every iterator valid
+        if (it != bucket.begin()) {
+            if (organization == BucketOrganization::MoveToFront) {
+                bucket.splice(bucket.begin(), bucket, it);
+            } else if (organization == BucketOrganization::Transpose) {
+                bucket.splice(std::prev(it), bucket, it);
+            }
+        }
+
+        return iterator(data.begin() + index, it, this);
     }
 
-    const_iterator find(const KeyType &key) const {
-        auto &bucket = data[bucketIndex(key)];
+    const_iterator findHashed(const KeyType &key, const size_t hash) const {
+        size_t index = hashIndex(hash);
+        auto &bucket = data[index];
 
         auto it = bucket.begin();
         while (it != bucket.end()) {
@@ -335,6 +933,73 @@ class HashMap {
             return end();
         }
 
-        return const_iterator(data.begin() + bucketIndex(key), it, this);
+        return const_iterator(data.begin() + index, it, this);
+    }
+
+  public:
+    // Lookup by any value the hasher can hash and compare with keys, e.g. a
+    // tuple of a composite key's components; needs a transparent hasher
+    // such as DefaultHash of a composite or string key.
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    iterator find(const Probe &probe) {
+        return find(probe, hasher(probe));
+    }
+
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    const_iterator find(const Probe &probe) const {
+        return find(probe, hasher(probe));
+    }
+
+    // Same for a hash computed earlier, e.g. that of a HashedKey constant.
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    iterator find(const Probe &probe, const size_t hash) {
+        checkHash(probe, hash);
+        size_t index = hashIndex(hash);
+        auto &bucket = data[index];
+        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+            if (Hash::equal(it->first, probe)) {
+                return iterator(data.begin() + index, it, this);
+            }
+        }
+        return end();
+    }
+
+    template<class Probe, class H = Hash, class = typename H::is_transparent>
+    const_iterator find(const Probe &probe, const size_t hash) const {
+        checkHash(probe, hash);
+        size_t index = hashIndex(hash);
+        auto &bucket = data[index];
+        for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+            if (Hash::equal(it->first, probe)) {
+                return const_iterator(data.begin() + index, it, this);
+            }
+        }
+        return end();
+    }
+
+    // Returns an element chosen uniformly at random, or end() if the map is
+    // empty. Takes bucket_count() * longest chain / size() draws on average,
+    // whatever the size of the map, and never more than about twice
+    // bucket_count() steps.
+    template<class URBG>
+    iterator random_element(URBG &generator) {
+        if (keyCount == 0) {
+            return end();
+        }
+        auto position = randomPosition(generator);
+        auto &bucket = data[position.first];
+        return iterator(data.begin() + position.first,
+                        std::next(bucket.begin(), position.second), this);
+    }
+
+    template<class URBG>
+    const_iterator random_element(URBG &generator) const {
+        if (keyCount == 0) {
+            return end();
+        }
+        auto position = randomPosition(generator);
+        auto &bucket = data[position.first];
+        return const_iterator(data.begin() + position.first,
+                              std::next(bucket.begin(), position.second), this);
     }
-};
\ No newline at end of file
+};
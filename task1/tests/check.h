@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Unlike assert(), stays on in optimized builds; a failed check ends the
+// test with the failing expression.
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,     \
+                         __LINE__, #condition);                             \
+            std::exit(1);                                                   \
+        }                                                                   \
+    } while (false)
@@ -0,0 +1,341 @@
+// Randomized differential test: runs the same random inserts, erases,
+// lookups and assignments on each map and on std::map, and compares every
+// answer and, now and then, the whole contents. Phases alternate between
+// growing and shrinking the key set, so the maps rehash both ways.
+//
+//   g++ -O2 -std=c++17 -Wno-deprecated-declarations differential_test.cpp -o differential_test
+//   ./differential_test [seed]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+
+#include "check.h"
+#include "../adaptive_hash_map.h"
+#include "../flat_hash_map.h"
+#include "../task1.h"
+#include "../tiered_hash_map.h"
+
+namespace {
+
+using Reference = std::map<uint64_t, std::string>;
+
+const int Operations = 200000;
+const int CompareEvery = 5000;
+
+// draws keys from a range that widens and narrows with the phase
+class Workload {
+  private:
+    std::mt19937_64 generator;
+
+  public:
+    explicit Workload(uint64_t seed) : generator(seed) {}
+
+    uint64_t key(int step) {
+        uint64_t range = (step / 25000) % 2 == 0 ? 5000 : 300;
+        return generator() % range;
+    }
+
+    // erases dominate while the key range is narrow
+    int operation(int step) {
+        int roll = static_cast<int>(generator() % 100);
+        if ((step / 25000) % 2 == 1 && roll < 40) {
+            return 1;
+        }
+        return roll % 4;
+    }
+
+    std::string value() {
+        return std::to_string(generator() % 1000000);
+    }
+};
+
+template<class Map>
+void compareChained(const Map &map, const Reference &reference) {
+    CHECK(map.size() == reference.size());
+    size_t visited = 0;
+    for (const auto &element : map) {
+        auto it = reference.find(element.first);
+        CHECK(it != reference.end() && it->second == element.second);
+        ++visited;
+    }
+    CHECK(visited == reference.size());
+}
+
+void testHashMap(uint64_t seed) {
+    Workload workload(seed);
+    HashMap<uint64_t, std::string> map;
+    Reference reference;
+    for (int step = 0; step < Operations; ++step) {
+        uint64_t key = workload.key(step);
+        switch (workload.operation(step)) {
+          case 0: {
+            std::string value = workload.value();
+            map.insert({key, value});
+            reference.insert({key, value});
+            break;
+          }
+          case 1:
+            map.erase(key);
+            reference.erase(key);
+            break;
+          case 2: {
+            auto it = map.find(key);
+            auto expected = reference.find(key);
+            CHECK((it == map.end()) == (expected == reference.end()));
+            CHECK(it == map.end() || it->second == expected->second);
+            break;
+          }
+          case 3: {
+            std::string value = workload.value();
+            map[key] = value;
+            reference[key] = value;
+            break;
+          }
+        }
+        if (step % CompareEvery == 0) {
+            compareChained(map, reference);
+        }
+    }
+    compareChained(map, reference);
+    map.shrink_to_fit();
+    compareChained(map, reference);
+    HashMap<uint64_t, std::string> copy(map);
+    compareChained(copy, reference);
+    map.clear();
+    reference.clear();
+    compareChained(map, reference);
+}
+
+void testFlatHashMap(uint64_t seed) {
+    Workload workload(seed);
+    FlatHashMap<uint64_t, std::string> map;
+    Reference reference;
+    for (int step = 0; step < Operations; ++step) {
+        uint64_t key = workload.key(step);
+        switch (workload.operation(step)) {
+          case 0: {
+            std::string value = workload.value();
+            map.insert({key, value});
+            reference.insert({key, value});
+            break;
+          }
+          case 1:
+            map.erase(key);
+            reference.erase(key);
+            break;
+          case 2: {
+            auto it = map.find(key);
+            auto expected = reference.find(key);
+            CHECK((it == map.end()) == (expected == reference.end()));
+            CHECK(it == map.end() || it->second == expected->second);
+            break;
+          }
+          case 3: {
+            std::string value = workload.value();
+            map[key] = value;
+            reference[key] = value;
+            break;
+          }
+        }
+        if (step % CompareEvery == 0) {
+            compareChained(map, reference);
+        }
+        if (step % 60000 == 59999) {
+            map.shrink_to_fit();
+        }
+    }
+    compareChained(map, reference);
+    map.clear();
+    reference.clear();
+    compareChained(map, reference);
+}
+
+// big enough for AdaptiveHashMap to prefer chaining under churn
+struct PaddedValue {
+    std::string text;
+    char padding[64] = {};
+};
+
+const std::string& textOf(const std::string &value) {
+    return value;
+}
+
+const std::string& textOf(const PaddedValue &value) {
+    return value.text;
+}
+
+template<class Value>
+void compareAdaptive(AdaptiveHashMap<uint64_t, Value> &map, const Reference &reference) {
+    CHECK(map.size() == reference.size());
+    size_t visited = 0;
+    map.for_each([&](const uint64_t &key, Value &value) {
+        auto it = reference.find(key);
+        CHECK(it != reference.end() && it->second == textOf(value));
+        ++visited;
+    });
+    CHECK(visited == reference.size());
+}
+
+// every engine is visited: the inline vector while small, Flat for small
+// elements and Chained for large ones under churn
+template<class Value>
+void testAdaptiveHashMap(uint64_t seed, AdaptiveEngine expected) {
+    Workload workload(seed);
+    AdaptiveHashMap<uint64_t, Value> map;
+    bool reached = false;
+    Reference reference;
+    for (int step = 0; step < Operations; ++step) {
+        uint64_t key = workload.key(step);
+        switch (workload.operation(step)) {
+          case 0: {
+            std::string value = workload.value();
+            map.insert({key, Value{value}});
+            reference.insert({key, value});
+            break;
+          }
+          case 1:
+            map.erase(key);
+            reference.erase(key);
+            break;
+          case 2: {
+            Value *value = map.find(key);
+            auto found = reference.find(key);
+            CHECK((value == nullptr) == (found == reference.end()));
+            CHECK(value == nullptr || textOf(*value) == found->second);
+            break;
+          }
+          case 3: {
+            std::string value = workload.value();
+            map[key] = Value{value};
+            reference[key] = value;
+            break;
+          }
+        }
+        reached = reached || map.current_engine() == expected;
+        if (step % CompareEvery == 0) {
+            compareAdaptive(map, reference);
+        }
+    }
+    CHECK(reached);
+    compareAdaptive(map, reference);
+    // shrinking to a handful of keys takes the map back to the inline engine
+    for (uint64_t key = 0; key < 5000; ++key) {
+        if (key >= 3) {
+            map.erase(key);
+            reference.erase(key);
+        }
+    }
+    for (int i = 0; i < 4096; ++i) {
+        map.find(0);
+    }
+    CHECK(map.current_engine() == AdaptiveEngine::Inline);
+    compareAdaptive(map, reference);
+}
+
+// time moves only when the test says so
+struct ManualClock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<ManualClock>;
+    static constexpr bool is_steady = true;
+
+    static rep ticks;
+
+    static time_point now() {
+        return time_point(duration(ticks));
+    }
+};
+
+ManualClock::rep ManualClock::ticks = 0;
+
+void testTieredHashMap(uint64_t seed) {
+    const int IdleTicks = 200;
+    Workload workload(seed);
+    TieredHashMap<uint64_t, std::string, DefaultHash<uint64_t>, ManualClock>
+        map(std::chrono::nanoseconds(IdleTicks), 16);
+    Reference reference;
+    // last use of each key, which decides whether it may be hot
+    std::map<uint64_t, ManualClock::rep> lastUse;
+    std::mt19937_64 generator(seed);
+    for (int step = 0; step < Operations / 4; ++step) {
+        ++ManualClock::ticks;
+        uint64_t key = workload.key(step * 4);
+        switch (workload.operation(step * 4)) {
+          case 0: {
+            std::string value = workload.value();
+            map.insert({key, value});
+            if (reference.insert({key, value}).second) {
+                lastUse[key] = ManualClock::ticks;
+            }
+            break;
+          }
+          case 1:
+            map.erase(key);
+            reference.erase(key);
+            lastUse.erase(key);
+            break;
+          case 2: {
+            map.set_promote_on_hit(generator() % 2 == 0);
+            std::string value;
+            bool found = map.get(key, value);
+            auto expected = reference.find(key);
+            CHECK(found == (expected != reference.end()));
+            CHECK(!found || value == expected->second);
+            if (found) {
+                lastUse[key] = ManualClock::ticks;
+            }
+            break;
+          }
+          case 3: {
+            std::string value = workload.value();
+            map[key] = value;
+            reference[key] = value;
+            lastUse[key] = ManualClock::ticks;
+            break;
+          }
+        }
+        CHECK(map.size() == reference.size());
+        if (step % 97 == 0) {
+            map.demote(generator() % 2 == 0 ? SIZE_MAX : generator() % 64);
+        }
+    }
+
+    // a full demote leaves exactly the keys used within IdleTicks hot,
+    // unless a cold hit was answered without promotion
+    map.set_promote_on_hit(true);
+    map.demote();
+    size_t recent = 0;
+    for (const auto &use : lastUse) {
+        if (ManualClock::ticks - use.second < IdleTicks) {
+            ++recent;
+        }
+    }
+    CHECK(map.hot_size() <= recent);
+    CHECK(map.size() == reference.size());
+    for (const auto &element : reference) {
+        std::string value;
+        CHECK(map.get(element.first, value) && value == element.second);
+    }
+    CHECK(map.cold_size() == 0);
+    map.clear();
+    CHECK(map.empty() && map.cold_bytes() == 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1;
+    testHashMap(seed);
+    testFlatHashMap(seed);
+    testAdaptiveHashMap<std::string>(seed, AdaptiveEngine::Flat);
+    testAdaptiveHashMap<PaddedValue>(seed, AdaptiveEngine::Chained);
+    testTieredHashMap(seed);
+    std::printf("differential_test: ok (seed %llu)\n", static_cast<unsigned long long>(seed));
+    return 0;
+}
@@ -0,0 +1,126 @@
+// HashMap::scan() across rehashes: every element present from the start of
+// a scan to its end has to be visited at least once, however the table
+// grows or shrinks between the calls.
+//
+//   g++ -O2 -std=c++17 -Wno-deprecated-declarations scan_test.cpp -o scan_test
+//   ./scan_test [seed]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+
+#include "check.h"
+#include "../task1.h"
+
+namespace {
+
+// Scans the map while churn(step) changes it between the calls, then checks
+// that the keys that stayed throughout were all seen.
+template<class Churn>
+void scanWhile(HashMap<uint64_t, uint64_t> &map, std::set<uint64_t> keys, size_t count,
+               Churn churn) {
+    // keys erased at any point during the scan are not owed a visit
+    std::set<uint64_t> stayed(keys);
+    std::set<uint64_t> seen;
+    size_t cursor = 0;
+    size_t step = 0;
+    do {
+        cursor = map.scan(cursor, count, [&](const std::pair<const uint64_t, uint64_t> &element) {
+            CHECK(element.second == element.first * 7);
+            seen.insert(element.first);
+        });
+        churn(step++, stayed);
+    } while (cursor != 0);
+    for (uint64_t key : stayed) {
+        CHECK(seen.count(key) == 1);
+    }
+}
+
+std::set<uint64_t> fill(HashMap<uint64_t, uint64_t> &map, uint64_t first, uint64_t last) {
+    std::set<uint64_t> keys;
+    for (uint64_t key = first; key < last; ++key) {
+        map.insert({key, key * 7});
+        keys.insert(key);
+    }
+    return keys;
+}
+
+void testGrowth() {
+    HashMap<uint64_t, uint64_t> map;
+    std::set<uint64_t> keys = fill(map, 0, 1000);
+    uint64_t next = 1000;
+    size_t before = map.bucket_count();
+    // the table doubles a few times early on; a scan that keeps falling
+    // behind a table growing at every step would not end
+    scanWhile(map, keys, 16, [&](size_t step, std::set<uint64_t> &) {
+        for (int i = 0; i < 200 && step < 40; ++i, ++next) {
+            map.insert({next, next * 7});
+        }
+    });
+    CHECK(map.bucket_count() > before);
+}
+
+void testShrink() {
+    HashMap<uint64_t, uint64_t> map;
+    std::set<uint64_t> keys = fill(map, 0, 20000);
+    size_t before = map.bucket_count();
+    uint64_t victim = 100;
+    scanWhile(map, keys, 16, [&](size_t, std::set<uint64_t> &stayed) {
+        for (int i = 0; i < 400 && victim < 20000; ++i, ++victim) {
+            map.erase(victim);
+            stayed.erase(victim);
+        }
+    });
+    CHECK(map.bucket_count() < before);
+}
+
+// growth and shrinking in turn, with random scan steps
+void testRandom(uint64_t seed) {
+    std::mt19937_64 generator(seed);
+    for (int round = 0; round < 10; ++round) {
+        HashMap<uint64_t, uint64_t> map;
+        std::set<uint64_t> keys = fill(map, 0, 1 + generator() % 5000);
+        scanWhile(map, keys, 1 + generator() % 64, [&](size_t step, std::set<uint64_t> &stayed) {
+            bool grow = (step / 8) % 2 == 0;
+            for (int i = 0; i < 50; ++i) {
+                uint64_t key = generator() % 10000;
+                if (grow) {
+                    map.insert({key, key * 7});
+                } else {
+                    map.erase(key);
+                    stayed.erase(key);
+                }
+            }
+            if (generator() % 16 == 0) {
+                map.shrink_to_fit();
+            }
+        });
+    }
+}
+
+// a scan started by the last step of another begins at cursor 0 again
+void testRestart() {
+    HashMap<uint64_t, uint64_t> map;
+    std::set<uint64_t> keys = fill(map, 0, 500);
+    for (int pass = 0; pass < 3; ++pass) {
+        scanWhile(map, keys, 1, [](size_t, std::set<uint64_t> &) {});
+    }
+    HashMap<uint64_t, uint64_t> empty;
+    CHECK(empty.scan(0, 10, [](const std::pair<const uint64_t, uint64_t> &) {
+        CHECK(false);
+    }) == 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1;
+    testGrowth();
+    testShrink();
+    testRandom(seed);
+    testRestart();
+    std::printf("scan_test: ok (seed %llu)\n", static_cast<unsigned long long>(seed));
+    return 0;
+}
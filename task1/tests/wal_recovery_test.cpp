@@ -0,0 +1,307 @@
+// DurableHashMap recovery from damaged logs. The log is cut at random
+// offsets, has a byte flipped, or loses the tail of the log moved aside by
+// a checkpoint a crashed process left running; every time the reopened map
+// has to hold exactly the state after some prefix of the mutations, and
+// writes made after recovery have to survive the next reopen.
+//
+//   g++ -O2 -std=c++17 -pthread -Wno-deprecated-declarations wal_recovery_test.cpp -o wal_recovery_test
+//   ./wal_recovery_test [seed]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "../durable_hash_map.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using Map = DurableHashMap<uint64_t, std::string>;
+using State = std::map<uint64_t, std::string>;
+
+struct Mutation {
+    ChangeOp op;
+    uint64_t key;
+    std::string value;
+};
+
+std::vector<Mutation> history(uint64_t seed, size_t count) {
+    std::mt19937_64 generator(seed);
+    std::vector<Mutation> mutations;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t key = generator() % 500;
+        ChangeOp op = static_cast<ChangeOp>(1 + generator() % 3);
+        mutations.push_back({op, key, "v" + std::to_string(generator() % 100000)});
+    }
+    return mutations;
+}
+
+void mutate(Map &map, const Mutation &mutation) {
+    switch (mutation.op) {
+      case ChangeOp::Insert:
+        map.insert({mutation.key, mutation.value});
+        break;
+      case ChangeOp::Erase:
+        map.erase(mutation.key);
+        break;
+      case ChangeOp::Assign:
+        map.assign(mutation.key, mutation.value);
+        break;
+    }
+}
+
+void mutate(State &state, const Mutation &mutation) {
+    switch (mutation.op) {
+      case ChangeOp::Insert:
+        state.insert({mutation.key, mutation.value});
+        break;
+      case ChangeOp::Erase:
+        state.erase(mutation.key);
+        break;
+      case ChangeOp::Assign:
+        state[mutation.key] = mutation.value;
+        break;
+    }
+}
+
+State contents(const Map &map) {
+    State state;
+    for (const auto &element : map.get_map()) {
+        state.insert(element);
+    }
+    return state;
+}
+
+// Returns the length of the longest prefix of mutations whose result is
+// recovered, or SIZE_MAX if no prefix matches. Keeps count of the keys on
+// which the replayed state and the recovered one differ, so each mutation
+// costs a lookup rather than a comparison of whole maps.
+size_t matchingPrefix(const std::vector<Mutation> &mutations, const State &recovered) {
+    State state;
+    auto differs = [&](uint64_t key) {
+        auto mine = state.find(key);
+        auto theirs = recovered.find(key);
+        if (mine == state.end() || theirs == recovered.end()) {
+            return (mine == state.end()) != (theirs == recovered.end());
+        }
+        return mine->second != theirs->second;
+    };
+    size_t differences = recovered.size();
+    size_t longest = differences == 0 ? 0 : SIZE_MAX;
+    for (size_t i = 0; i < mutations.size(); ++i) {
+        bool before = differs(mutations[i].key);
+        mutate(state, mutations[i]);
+        bool after = differs(mutations[i].key);
+        differences += static_cast<size_t>(after) - static_cast<size_t>(before);
+        if (differences == 0) {
+            longest = i + 1;
+        }
+    }
+    return longest;
+}
+
+State stateAfter(const std::vector<Mutation> &mutations, size_t count) {
+    State state;
+    for (size_t i = 0; i < count; ++i) {
+        mutate(state, mutations[i]);
+    }
+    return state;
+}
+
+class TemporaryDirectory {
+  private:
+    fs::path path;
+
+  public:
+    TemporaryDirectory() {
+        char pattern[] = "/tmp/wal_recovery_test.XXXXXX";
+        CHECK(::mkdtemp(pattern) != nullptr);
+        path = pattern;
+    }
+
+    ~TemporaryDirectory() {
+        fs::remove_all(path);
+    }
+
+    std::string get() const {
+        return path.string();
+    }
+};
+
+WalOptions smallGroups() {
+    WalOptions options;
+    options.groupCommitRecords = 8;
+    options.syncEveryGroups = 0;
+    options.checkpointLogBytes = 0;
+    return options;
+}
+
+// After recovery the map takes new writes, which the next reopen replays
+// on top of the recovered prefix.
+void checkContinues(const std::string &directory, const WalOptions &options, State expected) {
+    Mutation extra{ChangeOp::Assign, 1000000, "after recovery"};
+    {
+        Map map(directory, options);
+        CHECK(contents(map) == expected);
+        mutate(map, extra);
+        map.commit();
+    }
+    mutate(expected, extra);
+    Map map(directory, options);
+    CHECK(contents(map) == expected);
+}
+
+// cuts the log at random offsets, whole records or not
+void testTruncatedTail(uint64_t seed) {
+    std::vector<Mutation> mutations = history(seed, 2000);
+    std::mt19937_64 generator(seed);
+    size_t previousPrefix = 0;
+    for (int trial = 0; trial < 30; ++trial) {
+        TemporaryDirectory directory;
+        {
+            Map map(directory.get(), smallGroups());
+            for (const auto &mutation : mutations) {
+                mutate(map, mutation);
+            }
+        }
+        std::string log = directory.get() + "/wal.log";
+        uintmax_t size = fs::file_size(log);
+        // cut points grow from trial to trial, and so must the prefixes
+        uintmax_t cut = size * trial / 30 + generator() % (size / 30);
+        fs::resize_file(log, cut);
+
+        State recovered;
+        {
+            Map map(directory.get(), smallGroups());
+            recovered = contents(map);
+        }
+        size_t prefix = matchingPrefix(mutations, recovered);
+        CHECK(prefix != SIZE_MAX);
+        CHECK(prefix >= previousPrefix);
+        // the torn record was cut off, so the file ends on a record boundary
+        CHECK(fs::file_size(log) <= cut);
+        previousPrefix = prefix;
+        checkContinues(directory.get(), smallGroups(), recovered);
+    }
+}
+
+// a flipped byte ends the log at the record it lands in
+void testCorruptRecord(uint64_t seed) {
+    std::vector<Mutation> mutations = history(seed + 1, 1000);
+    TemporaryDirectory directory;
+    {
+        Map map(directory.get(), smallGroups());
+        for (const auto &mutation : mutations) {
+            mutate(map, mutation);
+        }
+    }
+    std::string log = directory.get() + "/wal.log";
+    uintmax_t size = fs::file_size(log);
+    {
+        std::fstream file(log, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(size / 2));
+        char byte = 0;
+        file.get(byte);
+        file.seekp(static_cast<std::streamoff>(size / 2));
+        file.put(static_cast<char>(byte ^ 0x5a));
+    }
+    State recovered;
+    {
+        Map map(directory.get(), smallGroups());
+        recovered = contents(map);
+    }
+    size_t prefix = matchingPrefix(mutations, recovered);
+    CHECK(prefix != SIZE_MAX && prefix < mutations.size());
+    CHECK(fs::file_size(log) <= size / 2);
+    checkContinues(directory.get(), smallGroups(), recovered);
+}
+
+// A process dies while a checkpoint is running, which leaves the log moved
+// aside next to the new one. Losing the end of the old log leaves a gap in
+// the sequence numbers, and the new log's records after it must not be
+// replayed.
+void testGapBetweenLogs(uint64_t seed) {
+    std::vector<Mutation> mutations = history(seed + 2, 20000);
+    WalOptions options = smallGroups();
+    options.checkpointLogBytes = 64 << 10;
+    options.checkpointStepRecords = 1;
+    TemporaryDirectory directory;
+    int report[2];
+    CHECK(::pipe(report) == 0);
+    pid_t child = ::fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        Map map(directory.get(), options);
+        size_t rotated = SIZE_MAX;
+        for (size_t i = 0; i < mutations.size(); ++i) {
+            if (rotated == SIZE_MAX && map.checkpointing()) {
+                rotated = i;
+            }
+            mutate(map, mutations[i]);
+            if (rotated != SIZE_MAX && i >= rotated + 200) {
+                map.commit();
+                size_t written = i + 1;
+                size_t message[2] = {rotated, written};
+                CHECK(::write(report[1], message, sizeof(message)) ==
+                      static_cast<ssize_t>(sizeof(message)));
+                // dies with the checkpoint unfinished
+                ::_exit(0);
+            }
+        }
+        ::_exit(1);
+    }
+    int status = 0;
+    CHECK(::waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    size_t message[2];
+    CHECK(::read(report[0], message, sizeof(message)) == static_cast<ssize_t>(sizeof(message)));
+    ::close(report[0]);
+    ::close(report[1]);
+    size_t rotated = message[0];
+    size_t written = message[1];
+    mutations.resize(written);
+
+    std::string previous = directory.get() + "/wal.log.previous";
+    std::string log = directory.get() + "/wal.log";
+    CHECK(fs::exists(previous) && fs::file_size(log) > 0);
+    CHECK(!fs::exists(directory.get() + "/checkpoint"));
+
+    // both logs intact: everything is replayed
+    {
+        Map map(directory.get(), options);
+        CHECK(contents(map) == stateAfter(mutations, written));
+    }
+
+    fs::resize_file(previous, fs::file_size(previous) / 2);
+    State recovered;
+    {
+        Map map(directory.get(), options);
+        recovered = contents(map);
+    }
+    size_t prefix = matchingPrefix(mutations, recovered);
+    CHECK(prefix != SIZE_MAX && prefix < rotated);
+    CHECK(fs::file_size(log) == 0);
+    checkContinues(directory.get(), options, recovered);
+}
+
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1;
+    testTruncatedTail(seed);
+    testCorruptRecord(seed);
+    testGapBetweenLogs(seed);
+    std::printf("wal_recovery_test: ok (seed %llu)\n", static_cast<unsigned long long>(seed));
+    return 0;
+}
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "task1.h"
+#include "lz_codec.h"
+#include "serialization.h"
+
+// Two-tier map: recently used entries live expanded in a HashMap, entries idle
+// for longer than coldAfter are moved by demote() into LZ-compressed blocks.
+// The hot tier keeps its keys in order of last use, so demote() only visits
+// the entries it moves. The cold tier is indexed by a flat directory of
+// (hash tag, block) pairs, so it stores no keys outside of the compressed
+// blocks themselves.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType>,
+         class Clock = std::chrono::steady_clock>
+class TieredHashMap {
+    using MyPair = typename std::pair<const KeyType, ValueType>;
+    using TimePoint = typename Clock::time_point;
+
+  private:
+    using AgeList = std::list<const KeyType*>;
+
+    struct HotEntry {
+        ValueType value;
+        TimePoint lastAccess;
+        typename AgeList::iterator age;
+    };
+
+    struct ColdBlock {
+        std::string payload;
+        uint32_t rawSize = 0;
+        uint32_t count = 0;
+    };
+
+    // open addressing with linear probing; duplicates are allowed because
+    // different keys may share a tag, a false match costs one decompression
+    struct DirectorySlot {
+        uint32_t tag;
+        uint32_t block;
+    };
+
+    static const uint32_t EmptyTag = 0;
+    static const uint32_t DeletedTag = 1;
+
+    Hash hasher;
+    HashMap<KeyType, HotEntry, Hash> hot;
+    // keys of hot, least recently used first; HashMap moves its nodes
+    // between buckets by splicing, so the pointers stay valid
+    AgeList ageOrder;
+
+    std::vector<ColdBlock> blocks;
+    std::vector<uint32_t> freeBlocks;
+    std::vector<DirectorySlot> directory;
+    // 64 - log2 of the directory size
+    unsigned directoryShift = 64;
+    size_t directoryLive = 0;
+    size_t directoryDeleted = 0;
+    size_t coldCount = 0;
+
+    typename Clock::duration coldAfter;
+    size_t blockEntries;
+    bool promoteOnHit = true;
+
+    static uint32_t tagOf(size_t hash) {
+        uint32_t tag = static_cast<uint32_t>(static_cast<uint64_t>(hash) >> 32) ^
+                       static_cast<uint32_t>(hash);
+        return tag < 2 ? tag + 2 : tag;
+    }
+
+    // the high bits of the product are the ones every bit of the tag reaches
+    size_t directoryStart(uint32_t tag) const {
+        return static_cast<size_t>((tag * 0x9E3779B97F4A7C15ull) >> directoryShift);
+    }
+
+    // Sized for the live slots alone, so a directory full of tombstones is
+    // rebuilt at the same size, or smaller, instead of doubling.
+    void directoryRebuild(size_t live) {
+        size_t capacity = 16;
+        directoryShift = 60;
+        while ((live + 1) * 2 > capacity) {
+            capacity *= 2;
+            --directoryShift;
+        }
+        std::vector<DirectorySlot> old(std::move(directory));
+        directory.assign(capacity, DirectorySlot{EmptyTag, 0});
+        directoryLive = 0;
+        directoryDeleted = 0;
+        for (const auto &slot : old) {
+            if (slot.tag > DeletedTag) {
+                directoryPlace(slot.tag, slot.block);
+            }
+        }
+    }
+
+    void directoryPlace(uint32_t tag, uint32_t block) {
+        size_t i = directoryStart(tag);
+        while (directory[i].tag > DeletedTag) {
+            i = (i + 1) & (directory.size() - 1);
+        }
+        if (directory[i].tag == DeletedTag) {
+            --directoryDeleted;
+        }
+        directory[i] = DirectorySlot{tag, block};
+        ++directoryLive;
+    }
+
+    void directoryInsert(size_t hash, uint32_t block) {
+        if ((directoryLive + directoryDeleted + 1) * 4 > directory.size() * 3) {
+            directoryRebuild(directoryLive + 1);
+        }
+        directoryPlace(tagOf(hash), block);
+    }
+
+    void directoryErase(size_t hash, uint32_t block) {
+        uint32_t tag = tagOf(hash);
+        size_t i = directoryStart(tag);
+        while (directory[i].tag != EmptyTag) {
+            if (directory[i].tag == tag && directory[i].block == block) {
+                directory[i].tag = DeletedTag;
+                --directoryLive;
+                ++directoryDeleted;
+                return;
+            }
+            i = (i + 1) & (directory.size() - 1);
+        }
+    }
+
+    template<class Visitor>
+    void directoryVisit(size_t hash, Visitor visit) const {
+        if (directory.empty()) {
+            return;
+        }
+        uint32_t tag = tagOf(hash);
+        size_t i = directoryStart(tag);
+        while (directory[i].tag != EmptyTag) {
+            if (directory[i].tag == tag && visit(directory[i].block)) {
+                return;
+            }
+            i = (i + 1) & (directory.size() - 1);
+        }
+    }
+
+    static void encode(std::string &raw, const KeyType &key, const ValueType &value) {
+        Serializer<KeyType>::write(raw, key);
+        Serializer<ValueType>::write(raw, value);
+    }
+
+    void unpack(uint32_t block, std::vector<std::pair<KeyType, ValueType>> &entries) const {
+        std::string raw;
+        if (!LzCodec::decompress(blocks[block].payload, blocks[block].rawSize, raw)) {
+            throw std::runtime_error("Corrupted cold block");
+        }
+        entries.clear();
+        const char *pos = raw.data();
+        const char *end = pos + raw.size();
+        while (pos != end) {
+            std::pair<KeyType, ValueType> entry;
+            if (!Serializer<KeyType>::read(pos, end, entry.first) ||
+                !Serializer<ValueType>::read(pos, end, entry.second)) {
+                throw std::runtime_error("Corrupted cold block");
+            }
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    void clearCold() {
+        blocks.clear();
+        freeBlocks.clear();
+        directory.clear();
+        directoryLive = 0;
+        directoryDeleted = 0;
+        coldCount = 0;
+    }
+
+    void hotInsert(const KeyType &key, ValueType value, TimePoint lastAccess) {
+        ageOrder.push_back(nullptr);
+        try {
+            hot.insert({key, HotEntry{std::move(value), lastAccess, std::prev(ageOrder.end())}});
+        } catch (...) {
+            ageOrder.pop_back();
+            throw;
+        }
+        ageOrder.back() = &hot.find(key)->first;
+    }
+
+    void hotErase(const KeyType &key) {
+        ageOrder.erase(hot.at(key).age);
+        hot.erase(key);
+    }
+
+    void touch(HotEntry &entry) {
+        entry.lastAccess = Clock::now();
+        ageOrder.splice(ageOrder.end(), ageOrder, entry.age);
+    }
+
+    uint32_t storeBlock(const std::string &raw, uint32_t count) {
+        uint32_t id;
+        if (!freeBlocks.empty()) {
+            id = freeBlocks.back();
+            freeBlocks.pop_back();
+        } else {
+            id = static_cast<uint32_t>(blocks.size());
+            blocks.emplace_back();
+        }
+        blocks[id].payload = LzCodec::compress(raw);
+        blocks[id].rawSize = static_cast<uint32_t>(raw.size());
+        blocks[id].count = count;
+        return id;
+    }
+
+    // Looks the key up in the cold tier; when remove is set the entry is cut
+    // out of its block, which is then recompressed or released.
+    bool coldLookup(const KeyType &key, ValueType *value, bool remove) {
+        if (coldCount == 0) {
+            return false;
+        }
+        size_t hash = hasher(key);
+        bool found = false;
+        uint32_t foundBlock = 0;
+        std::vector<std::pair<KeyType, ValueType>> entries;
+        directoryVisit(hash, [&](uint32_t block) {
+            unpack(block, entries);
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].first == key) {
+                    if (value != nullptr) {
+                        *value = std::move(entries[i].second);
+                    }
+                    entries.erase(entries.begin() + i);
+                    found = true;
+                    foundBlock = block;
+                    return true;
+                }
+            }
+            return false;
+        });
+        if (!found || !remove) {
+            return found;
+        }
+
+        directoryErase(hash, foundBlock);
+        --coldCount;
+        if (coldCount == 0) {
+            // every block is empty by now
+            clearCold();
+            return true;
+        }
+        if (entries.empty()) {
+            blocks[foundBlock] = ColdBlock();
+            freeBlocks.push_back(foundBlock);
+            return true;
+        }
+        std::string raw;
+        for (const auto &entry : entries) {
+            encode(raw, entry.first, entry.second);
+        }
+        blocks[foundBlock].payload = LzCodec::compress(raw);
+        blocks[foundBlock].rawSize = static_cast<uint32_t>(raw.size());
+        blocks[foundBlock].count = static_cast<uint32_t>(entries.size());
+        return true;
+    }
+
+  public:
+    explicit TieredHashMap(typename Clock::duration _coldAfter, size_t _blockEntries = 64,
+                           Hash _hasher = Hash()) :
+        hasher(_hasher), hot(_hasher), coldAfter(_coldAfter),
+        blockEntries(_blockEntries == 0 ? 1 : _blockEntries) {}
+
+    // ageOrder points into hot, so a copy would point into the original
+    TieredHashMap(const TieredHashMap &) = delete;
+    TieredHashMap& operator=(const TieredHashMap &) = delete;
+
+    // When disabled, cold hits are answered from the decompressed block and
+    // the entry stays cold.
+    void set_promote_on_hit(bool enabled) {
+        promoteOnHit = enabled;
+    }
+
+    size_t size() const {
+        return hot.size() + coldCount;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t hot_size() const {
+        return hot.size();
+    }
+
+    size_t cold_size() const {
+        return coldCount;
+    }
+
+    size_t cold_bytes() const {
+        size_t bytes = directory.size() * sizeof(DirectorySlot);
+        for (const auto &block : blocks) {
+            bytes += block.payload.size();
+        }
+        return bytes;
+    }
+
+    void insert(const MyPair &v) {
+        if (contains(v.first)) {
+            return;
+        }
+        hotInsert(v.first, v.second, Clock::now());
+    }
+
+    void erase(const KeyType &key) {
+        if (hot.find(key) != hot.end()) {
+            hotErase(key);
+            return;
+        }
+        coldLookup(key, nullptr, true);
+    }
+
+    bool contains(const KeyType &key) {
+        if (hot.find(key) != hot.end()) {
+            return true;
+        }
+        ValueType value;
+        return coldLookup(key, &value, false);
+    }
+
+    // Copies the value out; a cold hit is promoted unless promotion is disabled.
+    bool get(const KeyType &key, ValueType &value) {
+        auto it = hot.find(key);
+        if (it != hot.end()) {
+            touch(it->second);
+            value = it->second.value;
+            return true;
+        }
+        if (!coldLookup(key, &value, promoteOnHit)) {
+            return false;
+        }
+        if (promoteOnHit) {
+            hotInsert(key, value, Clock::now());
+        }
+        return true;
+    }
+
+    // Always promotes, since the returned reference must stay writable.
+    ValueType& operator[] (const KeyType &key) {
+        auto it = hot.find(key);
+        if (it == hot.end()) {
+            ValueType value = ValueType();
+            coldLookup(key, &value, true);
+            hotInsert(key, std::move(value), Clock::now());
+            return hot.find(key)->second.value;
+        }
+        touch(it->second);
+        return it->second.value;
+    }
+
+    // Moves up to limit entries idle for longer than coldAfter into compressed
+    // blocks of blockEntries entries each, least recently used first. Returns
+    // the number of entries moved.
+    size_t demote(size_t limit = SIZE_MAX) {
+        TimePoint now = Clock::now();
+        std::vector<KeyType> idle;
+        for (auto age = ageOrder.begin(); age != ageOrder.end() && idle.size() < limit; ++age) {
+            // the clock does not go back, so the rest were used later still
+            if (now - hot.find(**age)->second.lastAccess < coldAfter) {
+                break;
+            }
+            idle.push_back(**age);
+        }
+
+        for (size_t first = 0; first < idle.size(); first += blockEntries) {
+            size_t last = std::min(idle.size(), first + blockEntries);
+            std::string raw;
+            for (size_t i = first; i < last; ++i) {
+                encode(raw, idle[i], hot.at(idle[i]).value);
+            }
+            uint32_t block = storeBlock(raw, static_cast<uint32_t>(last - first));
+            for (size_t i = first; i < last; ++i) {
+                directoryInsert(hasher(idle[i]), block);
+                hotErase(idle[i]);
+            }
+            coldCount += last - first;
+        }
+        return idle.size();
+    }
+
+    void clear() {
+        hot.clear();
+        ageOrder.clear();
+        clearCold();
+    }
+};
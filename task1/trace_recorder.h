@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "task1.h"
+#include "serialization.h"
+
+// Operation traces of a HashMap, for replaying production access patterns
+// with trace_replay. A trace file is the 8-byte magic, a flags byte and a
+// sequence of records
+//   [u8 op][varint ns since previous record][u64 key hash]
+//   [varint key length][serialized key]   - only with TraceFlags::KeyBytes
+// Without key bytes the hash stands in for the key on replay, which keeps
+// skew and interleaving but not key sizes.
+enum class TraceOp : uint8_t {
+    Find = 1,
+    Insert = 2,
+    Erase = 3,
+    Assign = 4
+};
+
+struct TraceFlags {
+    static constexpr uint8_t KeyBytes = 1;
+};
+
+struct TraceRecord {
+    TraceOp op;
+    // nanoseconds since the start of the trace
+    uint64_t time;
+    uint64_t hash;
+    // serialized key, empty unless the trace has key bytes
+    std::string key;
+};
+
+namespace trace_detail {
+
+const char Magic[8] = {'H', 'M', 'T', 'R', 'A', 'C', 'E', '1'};
+
+inline void writeVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline bool readVarint(const char *&pos, const char *end, uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; pos != end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*pos++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace trace_detail
+
+// Appends records to a trace file through a buffer that is written out
+// whenever it fills up and on destruction.
+class TraceWriter {
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t BufferBytes = 1 << 16;
+
+    int fd = -1;
+    uint8_t flags;
+    std::string buffer;
+    Clock::time_point start;
+    uint64_t lastTime = 0;
+    uint64_t recordCount = 0;
+
+    void writeOut() {
+        const char *data = buffer.data();
+        size_t size = buffer.size();
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Trace write failed: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        buffer.clear();
+    }
+
+  public:
+    TraceWriter(const std::string &path, uint8_t _flags) : flags(_flags), start(Clock::now()) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        }
+        buffer.append(trace_detail::Magic, sizeof(trace_detail::Magic));
+        buffer.push_back(static_cast<char>(flags));
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter& operator=(const TraceWriter &) = delete;
+
+    ~TraceWriter() {
+        try {
+            flush();
+        } catch (const std::runtime_error &) {
+        }
+        ::close(fd);
+    }
+
+    bool records_keys() const {
+        return (flags & TraceFlags::KeyBytes) != 0;
+    }
+
+    uint64_t record_count() const {
+        return recordCount;
+    }
+
+    template<class KeyType>
+    void record(TraceOp op, uint64_t hash, const KeyType &key) {
+        uint64_t now = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        buffer.push_back(static_cast<char>(op));
+        trace_detail::writeVarint(buffer, now - lastTime);
+        Serializer<uint64_t>::write(buffer, hash);
+        if (records_keys()) {
+            std::string bytes;
+            Serializer<KeyType>::write(bytes, key);
+            trace_detail::writeVarint(buffer, bytes.size());
+            buffer.append(bytes);
+        }
+        lastTime = now;
+        ++recordCount;
+        if (buffer.size() >= BufferBytes) {
+            writeOut();
+        }
+    }
+
+    void flush() {
+        if (!buffer.empty()) {
+            writeOut();
+        }
+    }
+};
+
+// Parses a whole trace held in memory.
+class TraceReader {
+  private:
+    const char *pos;
+    const char *end;
+    uint8_t flags = 0;
+    uint64_t time = 0;
+
+  public:
+    TraceReader(const char *data, size_t size) : pos(data), end(data + size) {
+        if (size < sizeof(trace_detail::Magic) + 1 ||
+            std::memcmp(data, trace_detail::Magic, sizeof(trace_detail::Magic)) != 0) {
+            throw std::runtime_error("Not a HashMap trace");
+        }
+        pos += sizeof(trace_detail::Magic);
+        flags = static_cast<uint8_t>(*pos++);
+    }
+
+    bool has_keys() const {
+        return (flags & TraceFlags::KeyBytes) != 0;
+    }
+
+    // false at the end of the trace or at a truncated last record
+    bool next(TraceRecord &record) {
+        uint64_t delta;
+        if (pos == end) {
+            return false;
+        }
+        record.op = static_cast<TraceOp>(*pos++);
+        if (!trace_detail::readVarint(pos, end, delta) ||
+            !Serializer<uint64_t>::read(pos, end, record.hash)) {
+            return false;
+        }
+        time += delta;
+        record.time = time;
+        record.key.clear();
+        if (has_keys()) {
+            uint64_t length;
+            if (!trace_detail::readVarint(pos, end, length) ||
+                static_cast<uint64_t>(end - pos) < length) {
+                return false;
+            }
+            record.key.assign(pos, static_cast<size_t>(length));
+            pos += length;
+        }
+        return true;
+    }
+};
+
+// HashMap that records every operation to a trace file; recording key bytes
+// is opt-in since it may capture sensitive data.
+template<class KeyType, class ValueType, class Hash = DefaultHash<KeyType>,
+         class Policy = DefaultHashPolicy>
+class TracedHashMap {
+    using Map = HashMap<KeyType, ValueType, Hash, Policy>;
+    using MyPair = typename std::pair<const KeyType, ValueType>;
+
+  private:
+    Map map;
+    TraceWriter writer;
+
+    uint64_t hashOf(const KeyType &key) const {
+        return static_cast<uint64_t>(map.hash_function()(key));
+    }
+
+  public:
+    using iterator = typename Map::iterator;
+    using const_iterator = typename Map::const_iterator;
+
+    explicit TracedHashMap(const std::string &path, bool recordKeys = false, Hash _hasher = Hash()) :
+        map(_hasher), writer(path, recordKeys ? TraceFlags::KeyBytes : 0) {}
+
+    // the traced map; operations on it directly are not recorded
+    const Map& get_map() const {
+        return map;
+    }
+
+    size_t size() const {
+        return map.size();
+    }
+
+    bool empty() const {
+        return map.empty();
+    }
+
+    void insert(const MyPair &v) {
+        writer.record(TraceOp::Insert, hashOf(v.first), v.first);
+        map.insert(v);
+    }
+
+    void erase(const KeyType &key) {
+        writer.record(TraceOp::Erase, hashOf(key), key);
+        map.erase(key);
+    }
+
+    iterator find(const KeyType &key) {
+        writer.record(TraceOp::Find, hashOf(key), key);
+        return map.find(key);
+    }
+
+    ValueType& operator[] (const KeyType &key) {
+        writer.record(TraceOp::Assign, hashOf(key), key);
+        return map[key];
+    }
+
+    ValueType& at(const KeyType &key) {
+        writer.record(TraceOp::Find, hashOf(key), key);
+        return map.at(key);
+    }
+
+    iterator end() {
+        return map.end();
+    }
+
+    void flush() {
+        writer.flush();
+    }
+};
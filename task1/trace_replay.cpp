@@ -0,0 +1,251 @@
+// Replays a trace written by TracedHashMap against one engine and reports
+// throughput, per-operation latency, memory and probe statistics. Traces
+// with key bytes are replayed with std::string keys holding the serialized
+// key, others with the recorded hash as a uint64_t key.
+//
+//   g++ -O2 -std=c++17 trace_replay.cpp -o trace_replay
+//   ./trace_replay TRACE [--engine chained|flat|adaptive]
+//                  [--growth golden|doubling] [--repeat N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "adaptive_hash_map.h"
+#include "flat_hash_map.h"
+#include "task1.h"
+#include "trace_recorder.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string path;
+    std::string engine = "chained";
+    std::string growth = "golden";
+    size_t repeat = 1;
+};
+
+template<class KeyType>
+struct Operation {
+    TraceOp op;
+    KeyType key;
+};
+
+bool readFile(const std::string &path, std::string &out) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char buffer[1 << 16];
+    ssize_t got;
+    while ((got = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        out.append(buffer, static_cast<size_t>(got));
+    }
+    ::close(fd);
+    return got == 0;
+}
+
+size_t residentBytes() {
+    std::FILE *file = std::fopen("/proc/self/statm", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    unsigned long pages = 0, resident = 0;
+    if (std::fscanf(file, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    std::fclose(file);
+    return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+double percentile(const std::vector<double> &sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+}
+
+// engine adapters: whether a lookup hit
+template<class Map, class KeyType>
+bool lookup(Map &map, const KeyType &key) {
+    return map.find(key) != map.end();
+}
+
+template<class KeyType, class ValueType, class Hash>
+bool lookup(AdaptiveHashMap<KeyType, ValueType, Hash> &map, const KeyType &key) {
+    return map.find(key) != nullptr;
+}
+
+template<class Map, class KeyType>
+size_t apply(Map &map, const Operation<KeyType> &operation, uint64_t value) {
+    switch (operation.op) {
+      case TraceOp::Find:
+        return lookup(map, operation.key);
+      case TraceOp::Insert:
+        map.insert({operation.key, value});
+        break;
+      case TraceOp::Erase:
+        map.erase(operation.key);
+        break;
+      case TraceOp::Assign:
+        map[operation.key] = value;
+        break;
+    }
+    return 0;
+}
+
+template<class KeyType, class ValueType, class Hash, class Policy>
+void printProbes(const HashMap<KeyType, ValueType, Hash, Policy> &map) {
+    size_t used = 0, longest = 0;
+    for (size_t i = 0; i < map.bucket_count(); ++i) {
+        used += map.bucket_size(i) != 0;
+        longest = std::max(longest, map.bucket_size(i));
+    }
+    std::printf("chains       buckets %zu  used %zu  mean %.2f  max %zu\n", map.bucket_count(),
+                used, used == 0 ? 0.0 : static_cast<double>(map.size()) / used, longest);
+}
+
+template<class KeyType, class ValueType, class Hash, class Policy>
+void printProbes(const FlatHashMap<KeyType, ValueType, Hash, Policy> &map) {
+    size_t probes = 0, longest = 0;
+    for (const auto &element : map) {
+        size_t length = map.probe_length(element.first);
+        probes += length;
+        longest = std::max(longest, length);
+    }
+    std::printf("probes       capacity %zu  mean %.2f  max %zu\n", map.capacity(),
+                map.empty() ? 0.0 : static_cast<double>(probes) / map.size(), longest);
+}
+
+template<class KeyType, class ValueType, class Hash>
+void printProbes(const AdaptiveHashMap<KeyType, ValueType, Hash> &map) {
+    static const char *names[] = {"inline", "chained", "flat"};
+    size_t migrations = 0;
+    for (const auto &decision : map.decisions()) {
+        migrations += decision.from != decision.to;
+    }
+    std::printf("engine       %s after %zu evaluations, %zu migrations\n",
+                names[static_cast<int>(map.current_engine())], map.decisions().size(), migrations);
+}
+
+template<class Map, class KeyType>
+void replay(const std::vector<Operation<KeyType>> &operations, size_t repeat) {
+    // throughput pass, untimed per operation
+    size_t before = residentBytes();
+    size_t hits = 0;
+    Clock::time_point start = Clock::now();
+    Map map;
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < operations.size(); ++i) {
+            hits += apply(map, operations[i], i);
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    size_t after = residentBytes();
+
+    // latency pass on a fresh map; includes the cost of reading the clock
+    std::vector<double> latencies;
+    latencies.reserve(operations.size());
+    {
+        Map timed;
+        for (size_t i = 0; i < operations.size(); ++i) {
+            Clock::time_point begin = Clock::now();
+            apply(timed, operations[i], i);
+            latencies.push_back(std::chrono::duration<double, std::nano>(Clock::now() - begin).count());
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    size_t total = operations.size() * repeat;
+    std::printf("operations   %zu (%zu lookup hits)\n", total, hits);
+    std::printf("throughput   %.0f ops/s\n", total / seconds);
+    std::printf("latency ns   p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+                percentile(latencies, 0.5), percentile(latencies, 0.9),
+                percentile(latencies, 0.99), percentile(latencies, 0.999),
+                latencies.empty() ? 0.0 : latencies.back());
+    std::printf("memory       %zu keys, rss +%.1f MiB\n", map.size(),
+                (after > before ? after - before : 0) / 1048576.0);
+    printProbes(map);
+}
+
+template<class KeyType>
+int run(const Options &options, const std::vector<Operation<KeyType>> &operations) {
+    using GoldenPolicy = HashPolicy<MaskIndex, GoldenRatioGrowth>;
+    using DoublingPolicy = HashPolicy<MaskIndex, DoublingGrowth>;
+    if (options.engine == "chained" && options.growth == "golden") {
+        replay<HashMap<KeyType, uint64_t, DefaultHash<KeyType>, GoldenPolicy>>(operations, options.repeat);
+    } else if (options.engine == "chained" && options.growth == "doubling") {
+        replay<HashMap<KeyType, uint64_t, DefaultHash<KeyType>, DoublingPolicy>>(operations, options.repeat);
+    } else if (options.engine == "flat") {
+        replay<FlatHashMap<KeyType, uint64_t>>(operations, options.repeat);
+    } else if (options.engine == "adaptive") {
+        replay<AdaptiveHashMap<KeyType, uint64_t>>(operations, options.repeat);
+    } else {
+        std::fprintf(stderr, "unknown engine %s or growth %s\n",
+                     options.engine.c_str(), options.growth.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s TRACE [--engine chained|flat|adaptive] "
+                     "[--growth golden|doubling] [--repeat N]\n", argv[0]);
+        return 1;
+    }
+    options.path = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        const char *value = argv[i + 1];
+        if (option == "--engine") {
+            options.engine = value;
+        } else if (option == "--growth") {
+            options.growth = value;
+        } else if (option == "--repeat") {
+            options.repeat = std::max<size_t>(std::strtoul(value, nullptr, 10), 1);
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", option.c_str());
+            return 1;
+        }
+    }
+
+    std::string image;
+    if (!readFile(options.path, image)) {
+        std::fprintf(stderr, "cannot read %s\n", options.path.c_str());
+        return 1;
+    }
+    try {
+        TraceReader reader(image.data(), image.size());
+        TraceRecord record{};
+        uint64_t duration = 0;
+        std::vector<Operation<std::string>> keyed;
+        std::vector<Operation<uint64_t>> hashed;
+        while (reader.next(record)) {
+            if (reader.has_keys()) {
+                keyed.push_back({record.op, record.key});
+            } else {
+                hashed.push_back({record.op, record.hash});
+            }
+            duration = record.time;
+        }
+        size_t count = reader.has_keys() ? keyed.size() : hashed.size();
+        std::printf("trace        %zu records over %.3f s, %s\n", count, duration / 1e9,
+                    reader.has_keys() ? "key bytes" : "hashes only");
+        return reader.has_keys() ? run(options, keyed) : run(options, hashed);
+    } catch (const std::runtime_error &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+}
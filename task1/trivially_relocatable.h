@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A type is trivially relocatable if moving an object to a new address and
+// destroying the original is the same as copying its bytes, which holds for
+// most types that own memory through pointers but never point into
+// themselves. Containers may then relocate such elements with memcpy.
+//
+// User types opt in either by specializing the trait or with a member
+//   using trivially_relocatable = std::true_type;
+template<class T, class Enable = void>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+template<class T>
+struct is_trivially_relocatable<T, typename std::enable_if<
+    std::is_same<typename T::trivially_relocatable, typename T::trivially_relocatable>::value>::type>
+    : T::trivially_relocatable {};
+
+// map elements have const keys
+template<class First, class Second>
+struct is_trivially_relocatable<std::pair<First, Second>> : std::integral_constant<bool,
+    is_trivially_relocatable<typename std::remove_const<First>::type>::value &&
+    is_trivially_relocatable<typename std::remove_const<Second>::type>::value> {};
+
+template<class... Types>
+struct is_trivially_relocatable<std::tuple<Types...>> : std::integral_constant<bool,
+    (is_trivially_relocatable<Types>::value && ... && true)> {};
+
+template<class T, size_t N>
+struct is_trivially_relocatable<std::array<T, N>> : is_trivially_relocatable<T> {};
+
+template<class T>
+struct is_trivially_relocatable<std::unique_ptr<T>> : std::true_type {};
+
+template<class T>
+struct is_trivially_relocatable<std::shared_ptr<T>> : std::true_type {};
+
+template<class T>
+struct is_trivially_relocatable<std::weak_ptr<T>> : std::true_type {};
+
+#if defined(__GLIBCXX__) || defined(_LIBCPP_VERSION)
+// three pointers in both libraries
+template<class T>
+struct is_trivially_relocatable<std::vector<T>> : std::true_type {};
+#endif
+
+#if defined(_LIBCPP_VERSION)
+// libstdc++ strings point into their own small-string buffer, libc++ ones do not
+template<class Char, class Traits>
+struct is_trivially_relocatable<std::basic_string<Char, Traits>> : std::true_type {};
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "flat_hash_map.h"
+
+// Counters over a sliding window of the last `generations` periods, e.g. per
+// key request counts for rate limiting. Every period has its own FlatHashMap;
+// add() counts into the newest one, and rotate() starts a new period by
+// dropping the oldest table as a whole instead of decaying every counter.
+// Memory is bounded by the keys touched within the window.
+template<class KeyType, class CountType = uint64_t, class Hash = DefaultHash<KeyType> >
+class WindowedHashMap {
+    using Table = FlatHashMap<KeyType, CountType, Hash>;
+
+  private:
+    Hash hasher;
+    // a ring; current is the newest period
+    std::vector<Table> tables;
+    size_t current = 0;
+
+  public:
+    explicit WindowedHashMap(size_t generations, Hash _hasher = Hash()) : hasher(_hasher) {
+        tables.reserve(generations == 0 ? 1 : generations);
+        for (size_t i = 0; i < (generations == 0 ? 1 : generations); ++i) {
+            tables.emplace_back(_hasher);
+        }
+    }
+
+    size_t generations() const {
+        return tables.size();
+    }
+
+    // entries over all periods; a key counted in several periods is
+    // counted once per period
+    size_t entry_count() const {
+        size_t total = 0;
+        for (const auto &table : tables) {
+            total += table.size();
+        }
+        return total;
+    }
+
+    void add(const KeyType &key, const CountType delta = CountType(1)) {
+        tables[current][key] += delta;
+    }
+
+    // count of the key in the current period only
+    CountType current_count(const KeyType &key) const {
+        auto it = tables[current].find(key);
+        return it == tables[current].end() ? CountType() : it->second;
+    }
+
+    // The key's total over the whole window. The key is hashed once, and
+    // the first slots of all periods are fetched before any is searched.
+    CountType sum_over_window(const KeyType &key) const {
+        size_t hash = hasher(key);
+        for (const auto &table : tables) {
+            table.prefetch(hash);
+        }
+        CountType sum = CountType();
+        for (const auto &table : tables) {
+            auto it = table.find(key, hash);
+            if (it != table.end()) {
+                sum += it->second;
+            }
+        }
+        return sum;
+    }
+
+    // Starts a new period in the table of the oldest one. The table is
+    // cleared and keeps its slots, so a steady key set does not regrow it
+    // every period; when the keys and counts are trivially destructible
+    // the slots are not even visited. A table far larger than the period
+    // that just ended needed is freed instead, so that memory follows the
+    // keys of the window after a burst.
+    void rotate() {
+        size_t ended = tables[current].size();
+        current = (current + 1) % tables.size();
+        Table &retired = tables[current];
+        if (retired.capacity() > 8 * std::max<size_t>(ended, 8)) {
+            Table(hasher).swap(retired);
+        } else {
+            retired.clear();
+        }
+    }
+
+    // Moves the window forward by several periods at once, e.g. after a
+    // quiet spell; never does more work than clearing the window.
+    void advance(const uint64_t periods) {
+        for (uint64_t i = 0; i < periods && i < tables.size(); ++i) {
+            rotate();
+        }
+    }
+
+    void clear() {
+        advance(tables.size());
+    }
+};